@@ -4,10 +4,9 @@
 #include <math.h>
 
 #include "boosting.h"
+#include "cpu.h"
 #include "utils.h"
 
-#define TAU (EPS * EPS)
-
 void boosting_reset(boosting *bs)
 {
 	bs->vals = NULL;
@@ -222,93 +221,21 @@ void boosting_prepare(boosting *bs)
 	bs->best_index = 0;
 }
 
-static
-void make_buckets(boosting *bs, const double *feat_vals)
-{
-	unsigned int i, j;
-	double bkt_range;
-
-	memset(bs->buckets, 0, (bs->num_buckets + 1) * sizeof(unsigned int));
-	bkt_range = bs->bkt_max - bs->bkt_min;
-	for (i = 0; i < bs->n; i++) {
-		double fval = feat_vals[i];
-
-		if (fval < bs->bkt_min) {
-			j = 0;
-		} else if (fval >= bs->bkt_max)  {
-			j = bs->num_buckets;
-		} else {
-			fval = (fval - bs->bkt_min) / bkt_range;
-			j = (unsigned int) (fval * bs->num_buckets);
-		}
-
-		bs->next[i] = bs->buckets[j];
-		bs->buckets[j] = i + 1;
-	}
-}
-
-static
-void train_aux(boosting *bs, unsigned int index, unsigned int k)
-{
-	unsigned int i, j;
-	double val, init_val, sum_pf, sum_pn, sum_nf, sum_nn;
-	double sum2_pf, sum2_pn, sum2_nf, sum2_nn;
-
-	sum_pn = 0;
-	sum_nn = 0;
-	sum_pf = bs->init_sum_p[k];
-	sum_nf = bs->init_sum_n[k];
-
-	init_val = bs->init_val - sum_pf - sum_nf;
-
-	for (i = 0; i < bs->num_buckets; i++) {
-		j = bs->buckets[i];
-		if (j == 0) continue;
-		do {
-			j--;
-			if (bs->y[j] > 0 && bs->sel_parallel[j] == k) {
-				sum_pf -= bs->weights[k][j];
-				sum_pn += bs->weights[k][j];
-			} else if (bs->y[j] < 0) {
-				sum_nf -= bs->weights[k][j];
-				sum_nn += bs->weights[k][j];
-			}
-			j = bs->next[j];
-		} while (j > 0);
-
-		sum2_pf = MAX(TAU, sum_pf);
-		sum2_nf = MAX(TAU, sum_nf);
-		sum2_pn = MAX(TAU, sum_pn);
-		sum2_nn = MAX(TAU, sum_nn);
-
-		val = init_val;
-		val += 2 * sqrt(sum2_pf * sum2_nf);
-		val += 2 * sqrt(sum2_pn * sum2_nn);
-		if (val < bs->best_val) {
-			bs->best_val = val;
-			bs->best_index = index;
-			bs->best_parallel = k;
-			bs->best_thresh_index = i;
-			bs->best_sum_pn = sum2_pn;
-			bs->best_sum_nn = sum2_nn;
-			bs->best_sum_pf = sum2_pf;
-			bs->best_sum_nf = sum2_nf;
-		}
-	}
-}
-
 void boosting_train(boosting *bs, const double *feat_vals, unsigned int index,
                     unsigned int parallel)
 {
+	const kernels *kern;
 	unsigned int k;
-	make_buckets(bs, feat_vals);
+
+	kern = cpu_kernels();
+	kern->make_buckets(bs, feat_vals);
 
 	if (parallel == bs->num_parallels) {
 		for (k = 0; k < bs->num_parallels; k++) {
-			train_aux(bs, index, k);
+			kern->train_aux(bs, index, k);
 		}
 	} else {
-		train_aux(bs, index, parallel);
+		kern->train_aux(bs, index, parallel);
 	}
 }
 
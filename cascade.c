@@ -5,66 +5,156 @@
 #include <math.h>
 
 #include "cascade.h"
+#include "cascade_file.h"
+#include "compiled_cascade.h"
+#include "generated.h"
 #include "features.h"
 #include "image.h"
 #include "window.h"
+#include "cpu.h"
+#include "stopwatch.h"
 #include "utils.h"
 
 #define ALLOC_NUM                512
 #define DETECTED_ALLOC_NUM      8192
+#define TASK_ALLOC_NUM            64
+#define BAND_MIN_HEIGHT            4
+#define GRID_MIN_OBJECTS          64
+#define GRID_MAX_LEVELS           32
+#define GRID_NONE         0xFFFFFFFFU
+#define GRID_GROUP_SPLIT           8
+#define TASKS_PER_WORKER           4
+
+static
+int grow_objects(detected_object **pobjs, double **pscores,
+                 unsigned int *pcapacity, unsigned int capacity,
+                 unsigned int num_parallels)
+{
+	detected_object *objs, *new_objs;
+	double *scores, *new_scores;
+	unsigned int i, idx;
+	size_t size;
+
+	size = capacity * sizeof(detected_object);
+	new_objs = (detected_object *) xmalloc(size);
+	if (!new_objs) return FALSE;
+
+	size = capacity * num_parallels * sizeof(double);
+	new_scores = (double *) xmalloc(size);
+	if (!new_scores) {
+		free(new_objs);
+		return FALSE;
+	}
+
+	objs = *pobjs;
+	scores = *pscores;
+	for (i = 0; i < *pcapacity; i++) {
+		new_objs[i] = objs[i];
+		idx = (unsigned int) (objs[i].score - scores);
+		new_objs[i].score = &new_scores[idx];
+	}
+
+	for (; i < capacity; i++) {
+		new_objs[i].score = &new_scores[i * num_parallels];
+	}
+
+	if (scores) {
+		size = *pcapacity * num_parallels * sizeof(double);
+		memcpy(new_scores, scores, size);
+		free(scores);
+	}
+	if (objs) free(objs);
+
+	*pobjs = new_objs;
+	*pscores = new_scores;
+	*pcapacity = capacity;
+	return TRUE;
+}
 
 void cascade_reset(cascade *c)
 {
+	unsigned int i;
+
 	c->st = NULL;
 	c->lst = NULL;
 	c->stalloc = NULL;
 	c->stfree = NULL;
 	c->clalloc = NULL;
 	c->clfree = NULL;
+	c->tp = NULL;
+	c->workers = NULL;
+	c->levels = NULL;
+	c->tasks = NULL;
+	c->schedule = NULL;
 	c->detected_objects = NULL;
 	c->scores = NULL;
-
+	c->generated = NULL;
+	c->model = NULL;
+	c->grid_cells = NULL;
+	c->grid_next = NULL;
+	c->groups = NULL;
+	c->group_sums = NULL;
+	c->arena = NULL;
+
+	for (i = 0; i < CASCADE_MAX_OCTAVES; i++)
+		image_reset(&c->octaves[i]);
 	image_reset(&c->img);
 	features_reset(&c->f);
+	compiled_cascade_reset(&c->cc);
 }
 
 int cascade_init(cascade *c, unsigned int width, unsigned int height,
                  unsigned int num_parallels)
 {
 	unsigned int i;
-	detected_object *objs;
-	size_t size;
 
 	cascade_reset(c);
 	c->num_stages = 0;
 
 	features_init(&c->f);
 	image_init(&c->img);
+	compiled_cascade_init(&c->cc);
+	c->compiled = FALSE;
+	c->generation = 0;
+	c->views_generation = 0;
 
-	size = DETECTED_ALLOC_NUM * sizeof(detected_object);
-	objs = (detected_object *) xmalloc(size);
-	if (!objs) goto error_init;
-
-	c->detected_objects = objs;
-	c->capacity_objects = DETECTED_ALLOC_NUM;
-	c->num_detected_objects = 0;
+	c->num_workers = 0;
+	c->capacity_levels = 0;
+	c->num_tasks = 0;
+	c->capacity_tasks = 0;
 
 	c->num_parallels = num_parallels;
-
-	size = DETECTED_ALLOC_NUM * num_parallels * sizeof(double);
-	c->scores = (double *) xmalloc(size);
-	if (!c->scores) goto error_init;
-
-	for (i = 0; i < c->capacity_objects; i++) {
-		objs[i].score = &c->scores[i * num_parallels];
-	}
-
+	c->capacity_objects = 0;
+	c->num_detected_objects = 0;
+	c->num_jumbled_objects = 0;
+	c->capacity_grid_cells = 0;
+	c->capacity_grid_next = 0;
+	c->capacity_groups = 0;
+	c->capacity_group_sums = 0;
+	c->num_octaves = 0;
+	c->capacity_arena = 0;
+	for (i = 0; i < CASCADE_MAX_OCTAVES; i++)
+		image_init(&c->octaves[i]);
+	if (!grow_objects(&c->detected_objects, &c->scores,
+	                  &c->capacity_objects, DETECTED_ALLOC_NUM,
+	                  num_parallels))
+		goto error_init;
+
+	c->mode = 0;
 	c->width = width;
 	c->height = height;
 	c->min_width = width;
 	c->min_height = height;
 	c->max_width = 0;
 	c->max_height = 0;
+	c->min_neighbors = 0;
+	c->group_eps = 0.2;
+	c->dense_depth = 2;
+	c->skip_margin = 0;
+	c->skip_windows = 1;
+	c->coarse_stages = 0;
+	c->strip_height = 0;
+	c->pyramid_arena = FALSE;
 
 	return TRUE;
 
@@ -73,10 +163,78 @@ error_init:
 	return FALSE;
 }
 
+static
+void cascade_free_batch(cascade_worker *wk)
+{
+	if (wk->tops) {
+		free(wk->tops);
+		wk->tops = NULL;
+	}
+
+	if (wk->offsets) {
+		free(wk->offsets);
+		wk->offsets = NULL;
+	}
+
+	if (wk->index) {
+		free(wk->index);
+		wk->index = NULL;
+	}
+
+	if (wk->sel) {
+		free(wk->sel);
+		wk->sel = NULL;
+	}
+
+	if (wk->scores) {
+		free(wk->scores);
+		wk->scores = NULL;
+	}
+	wk->capacity_batch = 0;
+}
+
 void cascade_cleanup(cascade *c)
 {
+	unsigned int i;
+
 	features_cleanup(&c->f);
 	image_cleanup(&c->img);
+	compiled_cascade_cleanup(&c->cc);
+
+	if (c->workers) {
+		for (i = 0; i < c->num_workers; i++) {
+			cascade_worker *wk = &c->workers[i];
+			features_cleanup(&wk->f);
+			compiled_cascade_cleanup(&wk->cc);
+			if (wk->lane_scores) free(wk->lane_scores);
+			if (wk->lefts) free(wk->lefts);
+			if (wk->factors) free(wk->factors);
+			if (wk->candidates) free(wk->candidates);
+			cascade_free_batch(wk);
+		}
+		free(c->workers);
+		c->workers = NULL;
+	}
+
+	if (c->tasks) {
+		for (i = 0; i < c->capacity_tasks; i++) {
+			cascade_task *t = &c->tasks[i];
+			if (t->objs) free(t->objs);
+			if (t->scores) free(t->scores);
+		}
+		free(c->tasks);
+		c->tasks = NULL;
+	}
+
+	if (c->schedule) {
+		free(c->schedule);
+		c->schedule = NULL;
+	}
+
+	if (c->levels) {
+		free(c->levels);
+		c->levels = NULL;
+	}
 
 	if (c->detected_objects) {
 		free(c->detected_objects);
@@ -88,6 +246,34 @@ void cascade_cleanup(cascade *c)
 		c->scores = NULL;
 	}
 
+	if (c->grid_cells) {
+		free(c->grid_cells);
+		c->grid_cells = NULL;
+	}
+
+	if (c->grid_next) {
+		free(c->grid_next);
+		c->grid_next = NULL;
+	}
+
+	if (c->groups) {
+		free(c->groups);
+		c->groups = NULL;
+	}
+
+	if (c->group_sums) {
+		free(c->group_sums);
+		c->group_sums = NULL;
+	}
+
+	for (i = 0; i < CASCADE_MAX_OCTAVES; i++)
+		image_cleanup(&c->octaves[i]);
+
+	if (c->arena) {
+		free(c->arena);
+		c->arena = NULL;
+	}
+
 	while (c->clalloc) {
 		classifier *cl = c->clalloc;
 		c->clalloc = cl->next;
@@ -128,6 +314,16 @@ void cascade_set_params(cascade *c, double scale, double min_stddev,
 	c->multi_exit = multi_exit;
 }
 
+unsigned int cascade_get_mode(const cascade *c)
+{
+	return c->mode;
+}
+
+void cascade_set_mode(cascade *c, unsigned int mode)
+{
+	c->mode = mode;
+}
+
 void cascade_set_scan(cascade *c,
                       unsigned int min_width, unsigned int min_height,
                       unsigned int max_width, unsigned int max_height)
@@ -138,6 +334,71 @@ void cascade_set_scan(cascade *c,
 	c->max_height = max_height;
 }
 
+void cascade_get_grouping(const cascade *c, unsigned int *min_neighbors,
+                          double *group_eps)
+{
+	*min_neighbors = c->min_neighbors;
+	*group_eps = c->group_eps;
+}
+
+void cascade_set_grouping(cascade *c, unsigned int min_neighbors,
+                          double group_eps)
+{
+	c->min_neighbors = min_neighbors;
+	c->group_eps = group_eps;
+}
+
+void cascade_get_adaptive(const cascade *c, unsigned int *dense_depth,
+                          double *skip_margin, unsigned int *skip_windows)
+{
+	*dense_depth = c->dense_depth;
+	*skip_margin = c->skip_margin;
+	*skip_windows = c->skip_windows;
+}
+
+void cascade_set_adaptive(cascade *c, unsigned int dense_depth,
+                          double skip_margin, unsigned int skip_windows)
+{
+	c->dense_depth = dense_depth;
+	c->skip_margin = skip_margin;
+	c->skip_windows = skip_windows;
+}
+
+unsigned int cascade_get_coarse(const cascade *c)
+{
+	return c->coarse_stages;
+}
+
+void cascade_set_coarse(cascade *c, unsigned int coarse_stages)
+{
+	c->coarse_stages = coarse_stages;
+}
+
+unsigned int cascade_get_strip(const cascade *c)
+{
+	return c->strip_height;
+}
+
+void cascade_set_strip(cascade *c, unsigned int strip_height)
+{
+	c->strip_height = strip_height;
+}
+
+int cascade_get_pyramid(const cascade *c)
+{
+	return c->pyramid_arena;
+}
+
+void cascade_set_pyramid(cascade *c, int pyramid_arena)
+{
+	c->pyramid_arena = pyramid_arena;
+}
+
+void cascade_set_thread_pool(cascade *c, thread_pool *tp)
+{
+	c->tp = tp;
+}
+
 int cascade_overlap(const cascade *c, const window *w1, const window *w2)
 {
 	return window_overlap(w1, w2, c->match_thresh, c->overlap_thresh);
@@ -155,6 +416,7 @@ void cascade_free_stage(cascade *c, cascade_stage *st)
 			cl->next = c->clfree;
 			c->clfree = cl;
 		}
+		st->last[k] = NULL;
 	}
 
 	if (st->next)
@@ -170,6 +432,7 @@ void cascade_free_stage(cascade *c, cascade_stage *st)
 	st->next = c->stfree;
 	c->stfree = st;
 	c->num_stages--;
+	c->compiled = FALSE;
 }
 
 void cascade_clear(cascade *c)
@@ -181,6 +444,7 @@ void cascade_clear(cascade *c)
 	c->st = NULL;
 	c->lst = NULL;
 	c->num_stages = 0;
+	c->model = NULL;
 }
 
 void cascade_remove_last_stage(cascade *c)
@@ -199,6 +463,7 @@ void cascade_consolidate_stage(cascade *c, cascade_stage *st)
 		for (cl = st->cl[k]; cl; cl = cl->next)
 			st->intercept[k] += cl->intercept;
 	}
+	c->compiled = FALSE;
 }
 
 int cascade_copy(const cascade *from, cascade *to)
@@ -211,8 +476,15 @@ int cascade_copy(const cascade *from, cascade *to)
 	cascade_set_params(to, from->scale, from->min_stddev, from->step,
 	                   from->match_thresh, from->overlap_thresh,
 	                   from->multi_exit);
+	cascade_set_mode(to, from->mode);
 	cascade_set_scan(to, from->min_width, from->min_height,
 	                 from->max_width, from->max_height);
+	cascade_set_grouping(to, from->min_neighbors, from->group_eps);
+	cascade_set_adaptive(to, from->dense_depth, from->skip_margin,
+	                     from->skip_windows);
+	cascade_set_coarse(to, from->coarse_stages);
+	cascade_set_strip(to, from->strip_height);
+	cascade_set_pyramid(to, from->pyramid_arena);
 
 	for (st = from->st; st; st = st->next) {
 		nst = cascade_new_stage(to);
@@ -226,6 +498,7 @@ int cascade_copy(const cascade *from, cascade *to)
 				ncl->coef = cl->coef;
 				ncl->thresh = cl->thresh;
 				ncl->intercept = cl->intercept;
+				ncl->reject = cl->reject;
 			}
 		}
 		cascade_consolidate_stage(to, nst);
@@ -234,6 +507,44 @@ int cascade_copy(const cascade *from, cascade *to)
 	return TRUE;
 }
 
+/*
+ * Makes `to' evaluate the compiled stages of `from' instead of a copy
+ * of them; `to' keeps its own image, features, workers and detections.
+ * The model must stay compiled and alive while `to' detects with it.
+ */
+int cascade_share(const cascade *from, cascade *to)
+{
+	if (from->width != to->width || from->height != to->height
+	    || from->num_parallels != to->num_parallels) {
+		error("wrong parameters for cascade share");
+		return FALSE;
+	}
+
+	if (from->model)
+		from = from->model;
+
+	if (!from->compiled) {
+		error("only compiled cascades can be shared");
+		return FALSE;
+	}
+
+	cascade_clear(to);
+	cascade_set_params(to, from->scale, from->min_stddev, from->step,
+	                   from->match_thresh, from->overlap_thresh,
+	                   from->multi_exit);
+	cascade_set_mode(to, from->mode);
+	cascade_set_scan(to, from->min_width, from->min_height,
+	                 from->max_width, from->max_height);
+	cascade_set_grouping(to, from->min_neighbors, from->group_eps);
+	cascade_set_adaptive(to, from->dense_depth, from->skip_margin,
+	                     from->skip_windows);
+	cascade_set_coarse(to, from->coarse_stages);
+	cascade_set_strip(to, from->strip_height);
+	cascade_set_pyramid(to, from->pyramid_arena);
+	to->model = from;
+	return TRUE;
+}
+
 unsigned int cascade_max_classifiers(const cascade *c, unsigned int parallel)
 {
 	unsigned int max_classifiers = 0, num_classifiers;
@@ -267,9 +578,16 @@ classifier *cascade_new_classifier(cascade *c, cascade_stage *st,
 	}
 	cl = c->clfree;
 	c->clfree = cl->next;
-	cl->next = st->cl[parallel];
-	st->cl[parallel] = cl;
+	cl->next = NULL;
+	cl->reject = -HUGE_VAL;
+
+	if (st->last[parallel])
+		st->last[parallel]->next = cl;
+	else
+		st->cl[parallel] = cl;
+	st->last[parallel] = cl;
 	st->num_classifiers[parallel]++;
+	c->compiled = FALSE;
 	return cl;
 }
 
@@ -304,7 +622,8 @@ cascade_stage *cascade_new_stage(cascade *c)
 			return NULL;
 		}
 
-		size = ALLOC_NUM * c->num_parallels * sizeof(classifier *);
+		/* the first classifier of each parallel, then the last */
+		size = 2 * ALLOC_NUM * c->num_parallels * sizeof(classifier *);
 		ptrs = (classifier **) xmalloc(size);
 
 		if (!ptrs) {
@@ -316,6 +635,7 @@ cascade_stage *cascade_new_stage(cascade *c)
 
 		st->num_classifiers = num_classifiers;
 		st->cl = ptrs;
+		st->last = &ptrs[ALLOC_NUM * c->num_parallels];
 		st->intercept = intercept;
 
 		st->next = c->stalloc;
@@ -325,6 +645,7 @@ cascade_stage *cascade_new_stage(cascade *c)
 			    &num_classifiers[i * c->num_parallels];
 			st[i].intercept = &intercept[i * c->num_parallels];
 			st[i].cl = &ptrs[i * c->num_parallels];
+			st[i].last = &st->last[i * c->num_parallels];
 			st[i].next = &st[i + 1];
 		}
 		st[i - 1].next = NULL;
@@ -334,11 +655,13 @@ cascade_stage *cascade_new_stage(cascade *c)
 	c->stfree = st->next;
 
 	c->num_stages++;
+	c->compiled = FALSE;
 	st->next = NULL;
 	for (k = 0; k < c->num_parallels; k++) {
 		st->num_classifiers[k] = 0;
 		st->intercept[k] = 0;
 		st->cl[k] = NULL;
+		st->last[k] = NULL;
 	}
 
 	if (c->lst) {
@@ -354,6 +677,47 @@ cascade_stage *cascade_new_stage(cascade *c)
 	return st;
 }
 
+static
+int compile_stages(const cascade *c, compiled_cascade *cc)
+{
+	cascade_stage *st;
+	classifier *cl;
+	unsigned int k, num_classifiers;
+
+	num_classifiers = 0;
+	for (st = c->st; st; st = st->next) {
+		for (k = 0; k < c->num_parallels; k++)
+			num_classifiers += st->num_classifiers[k];
+	}
+
+	if (!compiled_cascade_allocate(cc, c->num_stages,
+	                               c->num_parallels, num_classifiers))
+		return FALSE;
+
+	for (st = c->st; st; st = st->next) {
+		for (k = 0; k < c->num_parallels; k++) {
+			compiled_cascade_add_group(cc, st->intercept[k]);
+			for (cl = st->cl[k]; cl; cl = cl->next) {
+				compiled_cascade_add(cc, &cl->fi,
+				                     cl->coef, cl->thresh,
+				                     cl->reject);
+			}
+		}
+	}
+	compiled_cascade_finish(cc);
+	return TRUE;
+}
+
+int cascade_compile(cascade *c)
+{
+	if (!compile_stages(c, &c->cc))
+		return FALSE;
+
+	c->generation++;
+	c->compiled = TRUE;
+	return TRUE;
+}
+
 int cascade_set_image(cascade *c, const image *img)
 {
 	unsigned int max_width, max_height;
@@ -394,279 +758,1767 @@ int cascade_set_image(cascade *c, const image *img)
 }
 
 static
-void cascade_precomp(cascade *c, unsigned int stride)
+int new_object(const cascade *c, cascade_task *t, const window *comp)
 {
-	cascade_stage *st;
-	classifier *cl;
+	const cascade_level *lvl;
+	detected_object *obj;
 
-	for (st = c->st; st; st = st->next) {
-		unsigned int k;
-		for (k = 0; k < c->num_parallels; k++) {
-			for (cl = st->cl[k]; cl; cl = cl->next) {
-				features_optimize(&cl->fi, &cl->fo, stride);
-			}
-		}
+	if (t->num_objects >= t->capacity_objects - 1) {
+		if (!grow_objects(&t->objs, &t->scores, &t->capacity_objects,
+		                  2 * t->capacity_objects, c->num_parallels))
+			return FALSE;
+	}
+
+	obj = &t->objs[t->num_objects++];
+	if (!(c->mode & CASCADE_MODE_SCALE)) {
+		obj->comp = *comp;
+		cascade_real_window(c, &obj->comp, &obj->w);
+		return TRUE;
 	}
+
+	lvl = &c->levels[t->level];
+	obj->w.left = comp->left;
+	obj->w.top = comp->top;
+	obj->w.width = lvl->win_width;
+	obj->w.height = lvl->win_height;
+
+	obj->comp.width = (unsigned int) floor(0.5 + comp->width / lvl->scale);
+	obj->comp.height = (unsigned int) floor(0.5 + comp->height / lvl->scale);
+	obj->comp.width = MAX(obj->comp.width, c->width);
+	obj->comp.height = MAX(obj->comp.height, c->height);
+	obj->comp.left = (unsigned int) (comp->left / lvl->scale);
+	obj->comp.top = (unsigned int) (comp->top / lvl->scale);
+	obj->comp.left = MIN(obj->comp.left, obj->comp.width - c->width);
+	obj->comp.top = MIN(obj->comp.top, obj->comp.height - c->height);
+	return TRUE;
 }
 
 static
-double cascade_evaluate1(cascade *c, unsigned int offset,
-                         unsigned int stride, double factor)
+int cmp_objects(const void *ptr1, const void *ptr2)
 {
-	cascade_stage *st;
-	classifier *cl;
-	double val, t;
-	detected_object *obj;
-
-	obj = &c->detected_objects[c->num_jumbled_objects];
-	obj->sel_parallel = 0;
-	val = 0;
-
-	for (st = c->st; st; st = st->next) {
-
-		if (c->multi_exit)
-			val += st->intercept[0];
-		else
-			val = st->intercept[0];
+	const detected_object *o1 = (const detected_object *) ptr1;
+	const detected_object *o2 = (const detected_object *) ptr2;
+	double score1, score2;
+	score1 = o1->score[o1->sel_parallel];
+	score2 = o2->score[o2->sel_parallel];
+	if (score1 < score2) return +1;
+	if (score1 > score2) return -1;
+	return 0;
+}
 
-		for (cl = st->cl[0]; cl; cl = cl->next) {
-			t = features_evaluate_fast(&c->f.sat[offset],
-			                           &cl->fo);
-			if (t >= factor * cl->thresh)
-				val += cl->coef;
-		}
-		if (val < 0) {
-			return val;
-		}
+static
+void keep_object(detected_object *objs, unsigned int i, unsigned int j)
+{
+	if (i != j) {
+		detected_object temp = objs[j];
+		objs[j] = objs[i];
+		objs[i] = temp;
 	}
-	obj->score[0] = val;
-	return val;
 }
 
 static
-double cascade_evaluate(cascade *c, unsigned int offset,
-                        unsigned int stride, double factor)
+int grow_grid(cascade *c, unsigned int num_cells, unsigned int num_objects)
 {
-	cascade_stage *st;
-	classifier *cl;
-	double val, t;
-	detected_object *obj;
-	double *score;
-	unsigned int k, sel;
-
-	if (c->num_parallels == 1)
-		return cascade_evaluate1(c, offset, stride, factor);
-
-	obj = &c->detected_objects[c->num_jumbled_objects];
-	score = obj->score;
-	for (k = 0; k < c->num_parallels; k++)
-		score[k] = 0;
-
-	for (st = c->st; st; st = st->next) {
-		sel = 0;
-		for (k = 0; k < c->num_parallels; k++) {
-
-			if (c->multi_exit)
-				score[k] += st->intercept[k];
-			else
-				score[k] = st->intercept[k];
+	if (c->capacity_grid_cells < num_cells) {
+		if (c->grid_cells) free(c->grid_cells);
+		c->grid_cells = (unsigned int *)
+		    xmalloc(num_cells * sizeof(unsigned int));
+		c->capacity_grid_cells = (c->grid_cells) ? num_cells : 0;
+		if (!c->grid_cells) return FALSE;
+	}
 
-			for (cl = st->cl[k]; cl; cl = cl->next) {
-				t = features_evaluate_fast(&c->f.sat[offset],
-				                           &cl->fo);
-				if (t >= factor * cl->thresh)
-					score[k] += cl->coef;
-			}
-			if (score[k] > score[sel])
-				sel = k;
-		}
-		obj->sel_parallel = sel;
-		if (score[sel] < 0) {
-			return score[sel];
-		}
+	if (c->capacity_grid_next < num_objects) {
+		if (c->grid_next) free(c->grid_next);
+		c->grid_next = (unsigned int *)
+		    xmalloc(num_objects * sizeof(unsigned int));
+		c->capacity_grid_next = (c->grid_next) ? num_objects : 0;
+		if (!c->grid_next) return FALSE;
 	}
-	val = score[obj->sel_parallel];
-	return val;
+	return TRUE;
 }
 
+/*
+ * Windows are binned by their top-left corner in one uniform grid per
+ * size octave, whose cells are the largest window size of the octave
+ * divided by split. With positive thresholds only intersecting windows
+ * overlap, so a window only has to be checked against the cells that
+ * can hold windows reaching it.
+ */
+struct object_grid_st {
+	unsigned int base, num_levels, num_cells;
+	unsigned int cols[GRID_MAX_LEVELS], rows[GRID_MAX_LEVELS];
+	unsigned int first[GRID_MAX_LEVELS], cell[GRID_MAX_LEVELS];
+};
+
+typedef int (*object_grid_cb)(void *arg, unsigned int idx);
+
 static
-int new_object(cascade *c, const window *comp)
+int grid_init(cascade *c, const detected_object *objs,
+              unsigned int num_objects, unsigned int split,
+              struct object_grid_st *g)
 {
-	detected_object *obj;
-
-	if (c->num_jumbled_objects >= c->capacity_objects - 1) {
-		detected_object *new_objs;
-		size_t size;
-		unsigned int i;
-		double *new_scores;
+	unsigned int i, k, size, right, bottom, num_cells;
+	const window *w;
 
-		size = 2 * c->capacity_objects * sizeof(detected_object);
-		new_objs = xmalloc(size);
-		if (!new_objs) return FALSE;
+	if (num_objects < GRID_MIN_OBJECTS)
+		return FALSE;
 
-		size = 2 * c->capacity_objects * c->num_parallels
-		         * sizeof(double);
-		new_scores = xmalloc(size);
-		if (!new_scores) {
-			free(new_objs);
+	g->base = 0;
+	right = bottom = 0;
+	for (i = 0; i < num_objects; i++) {
+		w = &objs[i].w;
+		if (w->width == 0 || w->height == 0)
 			return FALSE;
-		}
-
-		size = c->capacity_objects * c->num_parallels
-		       * sizeof(double);
-		memcpy(new_scores, c->scores, size);
-
-		for (i = 0; i < c->capacity_objects; i++) {
-			detected_object *obj;
-			unsigned int idx;
+		size = MAX(w->width, w->height);
+		g->base = (i == 0) ? size : MIN(g->base, size);
+		right = MAX(right, w->left + w->width);
+		bottom = MAX(bottom, w->top + w->height);
+	}
 
-			obj = &c->detected_objects[i];
-			idx = (unsigned int) (obj->score - c->scores);
-			obj->score = &new_scores[idx];
-		}
+	g->num_levels = 0;
+	num_cells = 0;
+	for (size = g->base; g->num_levels < GRID_MAX_LEVELS; size *= 2) {
+		k = g->num_levels++;
+		g->cell[k] = MAX(1, size / split);
+		g->cols[k] = right / g->cell[k] + 1;
+		g->rows[k] = bottom / g->cell[k] + 1;
+		g->first[k] = num_cells;
+		num_cells += g->cols[k] * g->rows[k];
+		if (size >= right && size >= bottom)
+			break;
+	}
 
-		for (; i < 2 * c->capacity_objects; i++) {
-			new_objs[i].score = &new_scores[i * c->num_parallels];
-		}
+	/* the cells are followed by one representative each for grouping */
+	if (!grow_grid(c, 2 * num_cells, num_objects))
+		return FALSE;
 
-		free(c->scores);
-		c->scores = new_scores;
+	g->num_cells = num_cells;
+	for (i = 0; i < 2 * num_cells; i++)
+		c->grid_cells[i] = GRID_NONE;
+	return TRUE;
+}
 
-		size = c->capacity_objects * sizeof(detected_object);
-		memcpy(new_objs, c->detected_objects, size);
-		free(c->detected_objects);
+static
+unsigned int grid_insert(cascade *c, const struct object_grid_st *g,
+                         const window *w, unsigned int idx)
+{
+	unsigned int k, size, cell;
 
-		c->capacity_objects *= 2;
-		c->detected_objects = new_objs;
-	}
+	size = MAX(w->width, w->height);
+	for (k = 0; (g->base << k) < size; k++);
 
-	obj = &c->detected_objects[c->num_jumbled_objects++];
-	obj->comp = *comp;
-	cascade_real_window(c, &obj->comp, &obj->w);
-	return TRUE;
+	size = g->cell[k];
+	cell = g->first[k] + (w->top / size) * g->cols[k] + w->left / size;
+	c->grid_next[idx] = c->grid_cells[cell];
+	c->grid_cells[cell] = idx;
+	return cell;
 }
 
 static
-int cmp_objects(const void *ptr1, const void *ptr2)
+void grid_range(const struct object_grid_st *g, const window *w,
+                unsigned int k, unsigned int *x0, unsigned int *x1,
+                unsigned int *y0, unsigned int *y1)
 {
-	const detected_object *o1 = (const detected_object *) ptr1;
-	const detected_object *o2 = (const detected_object *) ptr2;
-	double score1, score2;
-	score1 = o1->score[o1->sel_parallel];
-	score2 = o2->score[o2->sel_parallel];
-	if (score1 < score2) return +1;
-	if (score1 > score2) return -1;
-	return 0;
+	unsigned int size, cell;
+
+	size = g->base << k;
+	cell = g->cell[k];
+	*x0 = (w->left + 1 > size) ? (w->left + 1 - size) / cell : 0;
+	*y0 = (w->top + 1 > size) ? (w->top + 1 - size) / cell : 0;
+	*x1 = MIN(g->cols[k] - 1, (w->left + w->width - 1) / cell);
+	*y1 = MIN(g->rows[k] - 1, (w->top + w->height - 1) / cell);
 }
 
-void cascade_separate(cascade *c, unsigned int offset)
+/* Calls cb for every binned window that may intersect w, until it
+ * returns TRUE */
+static
+int grid_search(const cascade *c, const struct object_grid_st *g,
+                const window *w, object_grid_cb cb, void *arg)
 {
-	unsigned int i, j, l;
-	detected_object *objs;
+	unsigned int k, cell, l;
+	unsigned int x, y, x0, x1, y0, y1;
+
+	for (k = 0; k < g->num_levels; k++) {
+		grid_range(g, w, k, &x0, &x1, &y0, &y1);
+		for (y = y0; y <= y1; y++) {
+			for (x = x0; x <= x1; x++) {
+				cell = g->first[k] + y * g->cols[k] + x;
+				for (l = c->grid_cells[cell]; l != GRID_NONE;
+				     l = c->grid_next[l]) {
+					if (cb(arg, l))
+						return TRUE;
+				}
+			}
+		}
+	}
+	return FALSE;
+}
 
-	if (c->num_jumbled_objects == 0)
-		return;
+struct overlap_st {
+	const cascade *c;
+	const detected_object *objs;
+	unsigned int idx;
+	unsigned int *parent;
+};
 
-	if (offset < c->num_jumbled_objects) {
-		qsort(&c->detected_objects[offset],
-		      c->num_jumbled_objects - offset,
-		      sizeof(detected_object), &cmp_objects);
-	}
+static
+int overlaps_object(void *arg, unsigned int l)
+{
+	struct overlap_st *info = (struct overlap_st *) arg;
+	const cascade *c = info->c;
 
-	j = 1;
-	objs = c->detected_objects;
-	for (i = 1; i < c->num_jumbled_objects; i++) {
-		for (l = 0; l < j; l++) {
-			if (window_overlap(&objs[l].w, &objs[i].w,
-			                   c->match_thresh,
-			                   c->overlap_thresh))
-				break;
-		}
-		if (l < j) continue;
+	return window_overlap(&info->objs[l].w, &info->objs[info->idx].w,
+	                      c->match_thresh, c->overlap_thresh);
+}
 
-		if (i != j) {
-			detected_object temp = objs[j];
-			objs[j] = objs[i];
-			objs[i] = temp;
+/* Greedy suppression: keeps each window that overlaps no better one */
+static
+unsigned int separate_greedy(cascade *c, detected_object *objs,
+                             unsigned int num_objects, int use_grid)
+{
+	struct object_grid_st g;
+	struct overlap_st info;
+	unsigned int i, j, l;
+	int grid;
+
+	grid = use_grid && c->match_thresh > 0 && c->overlap_thresh > 0
+	       && grid_init(c, objs, num_objects, 1, &g);
+	info.c = c;
+	info.objs = objs;
+
+	j = 0;
+	for (i = 0; i < num_objects; i++) {
+		info.idx = i;
+		if (grid) {
+			if (grid_search(c, &g, &objs[i].w, &overlaps_object,
+			                &info))
+				continue;
+		} else {
+			for (l = 0; l < j; l++) {
+				if (overlaps_object(&info, l))
+					break;
+			}
+			if (l < j) continue;
 		}
+
+		keep_object(objs, i, j);
+		if (grid) grid_insert(c, &g, &objs[j].w, j);
 		j++;
 	}
-	c->num_detected_objects = j;
+	return j;
 }
 
-int cascade_detect(cascade *c, int separate_detected)
+static
+unsigned int find_group(unsigned int *parent, unsigned int i)
 {
-	unsigned int i, offset, istep;
-	double score, stddev, factor;
-	double step, width, height;
-	window comp, inner;
-	int error;
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
 
-	c->num_detected_objects = 0;
-	c->num_jumbled_objects = 0;
-	comp.width = c->src->width;
-	comp.height = c->src->height;
-	inner.width = c->width;
-	inner.height = c->height;
+/* Unlike suppression, grouping needs windows of about the same size
+ * and position, or groups chain together across scales */
+static
+int join_object(void *arg, unsigned int l)
+{
+	struct overlap_st *info = (struct overlap_st *) arg;
+	unsigned int r1, r2;
+
+	r1 = find_group(info->parent, info->idx);
+	r2 = find_group(info->parent, l);
+	if (r1 == r2)
+		return FALSE;
+	if (!window_similar(&info->objs[l].w, &info->objs[info->idx].w,
+	                    info->c->group_eps))
+		return FALSE;
+
+	/* the better scoring window (lower index) stays the root */
+	if (r1 < r2)
+		info->parent[r2] = r1;
+	else
+		info->parent[r1] = r2;
+	return FALSE;
+}
+
+/*
+ * Joins window idx with every binned window similar to it, whose corners
+ * are no further from that of idx than the largest offset that
+ * window_similar() allows, and whose sizes no further than twice that
+ * offset.  A cell keeps a representative while all its windows are in the same
+ * group; as groups only merge, such a cell has nothing to join once idx
+ * is in that group, which keeps dense clusters from being scanned over
+ * and over.
+ */
+static
+void grid_join(cascade *c, const struct object_grid_st *g,
+               struct overlap_st *info)
+{
+	unsigned int k, cell, l, r, rep, margin, size;
+	unsigned int x, y, x0, x1, y0, y1;
+	unsigned int *parent, *reps;
+	const window *w;
+
+	w = &info->objs[info->idx].w;
+	margin = (unsigned int) ceil(0.5 * c->group_eps
+	                             * (w->width + w->height));
+	size = MAX(w->width, w->height);
+
+	parent = info->parent;
+	reps = &c->grid_cells[g->num_cells];
+	for (k = 0; k < g->num_levels; k++) {
+		if ((g->base << k) + 2 * margin < size) continue;
+		if (k > 0 && (g->base << (k - 1)) >= size + 2 * margin) break;
+
+		cell = g->cell[k];
+		x0 = (w->left > margin) ? (w->left - margin) / cell : 0;
+		y0 = (w->top > margin) ? (w->top - margin) / cell : 0;
+		x1 = MIN(g->cols[k] - 1, (w->left + margin) / cell);
+		y1 = MIN(g->rows[k] - 1, (w->top + margin) / cell);
+		for (y = y0; y <= y1; y++) {
+			for (x = x0; x <= x1; x++) {
+				cell = g->first[k] + y * g->cols[k] + x;
+				if (c->grid_cells[cell] == GRID_NONE)
+					continue;
+
+				rep = reps[cell];
+				for (l = c->grid_cells[cell]; l != GRID_NONE;
+				     l = c->grid_next[l]) {
+					if (rep != GRID_NONE
+					    && find_group(parent, rep)
+					       == find_group(parent, info->idx))
+						break;
+					join_object(info, l);
+				}
+				if (rep != GRID_NONE) continue;
+
+				l = c->grid_cells[cell];
+				r = find_group(parent, l);
+				for (l = c->grid_next[l]; l != GRID_NONE;
+				     l = c->grid_next[l]) {
+					if (find_group(parent, l) != r)
+						break;
+				}
+				if (l == GRID_NONE)
+					reps[cell] = c->grid_cells[cell];
+			}
+		}
+	}
+}
+
+static
+int grow_groups(cascade *c, unsigned int num_objects,
+                unsigned int num_sums)
+{
+	if (c->capacity_groups < 2 * num_objects) {
+		if (c->groups) free(c->groups);
+		c->groups = (unsigned int *)
+		    xmalloc(2 * num_objects * sizeof(unsigned int));
+		c->capacity_groups = (c->groups) ? 2 * num_objects : 0;
+		if (!c->groups) return FALSE;
+	}
+
+	if (c->capacity_group_sums < num_sums) {
+		if (c->group_sums) free(c->group_sums);
+		c->group_sums = (double *) xmalloc(num_sums * sizeof(double));
+		c->capacity_group_sums = (c->group_sums) ? num_sums : 0;
+		if (!c->group_sums) return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Joins similar windows into groups with union-find and keeps the
+ * groups of more than min_neighbors windows, each as the average box
+ * of its windows with their scores summed. Every group keeps the comp
+ * of its best window, as comps of different levels don't average.
+ */
+static
+int separate_groups(cascade *c, detected_object *objs,
+                    unsigned int num_objects)
+{
+	unsigned int i, k, l, r, num_groups, np, stride, cell;
+	unsigned int *parent, *count, *reps;
+	struct object_grid_st g;
+	struct overlap_st info;
+	double *sum;
+	window *w;
+	int grid;
+
+	np = c->num_parallels;
+	stride = 5 + np;
+	if (!grow_groups(c, num_objects, num_objects * stride))
+		return FALSE;
+
+	parent = c->groups;
+	count = &c->groups[num_objects];
+	for (i = 0; i < num_objects; i++)
+		parent[i] = i;
+
+	grid = grid_init(c, objs, num_objects, GRID_GROUP_SPLIT, &g);
+	info.c = c;
+	info.objs = objs;
+	info.parent = parent;
+	for (i = 0; i < num_objects; i++) {
+		info.idx = i;
+		if (grid) {
+			grid_join(c, &g, &info);
+			cell = grid_insert(c, &g, &objs[i].w, i);
+			reps = &c->grid_cells[g.num_cells];
+			if (c->grid_next[i] == GRID_NONE)
+				reps[cell] = i;
+			else if (reps[cell] != GRID_NONE
+			         && find_group(parent, reps[cell])
+			            != find_group(parent, i))
+				reps[cell] = GRID_NONE;
+		} else {
+			for (l = 0; l < i; l++)
+				join_object(&info, l);
+		}
+	}
+
+	for (i = 0; i < num_objects; i++)
+		count[i] = 0;
+	for (i = 0; i < num_objects; i++)
+		count[find_group(parent, i)]++;
+
+	/* groups are numbered in the order of their best windows */
+	num_groups = 0;
+	for (i = 0; i < num_objects; i++) {
+		if (parent[i] != i) continue;
+		if (count[i] <= c->min_neighbors) {
+			count[i] = GRID_NONE;
+			continue;
+		}
+
+		sum = &c->group_sums[num_groups * stride];
+		for (k = 0; k < stride; k++)
+			sum[k] = 0;
+		count[i] = num_groups++;
+	}
+
+	for (i = 0; i < num_objects; i++) {
+		l = count[find_group(parent, i)];
+		if (l == GRID_NONE) continue;
+
+		sum = &c->group_sums[l * stride];
+		sum[0] += objs[i].w.left;
+		sum[1] += objs[i].w.top;
+		sum[2] += objs[i].w.width;
+		sum[3] += objs[i].w.height;
+		sum[4] += 1;
+		for (k = 0; k < np; k++)
+			sum[5 + k] += objs[i].score[k];
+	}
+
+	/* roots only move down, onto slots that were already visited */
+	for (i = 0; i < num_objects; i++) {
+		if (parent[i] != i || count[i] == GRID_NONE) continue;
+
+		l = count[i];
+		keep_object(objs, i, l);
+
+		sum = &c->group_sums[l * stride];
+		w = &objs[l].w;
+		w->left = (unsigned int) floor(0.5 + sum[0] / sum[4]);
+		w->top = (unsigned int) floor(0.5 + sum[1] / sum[4]);
+		w->width = (unsigned int) floor(0.5 + sum[2] / sum[4]);
+		w->height = (unsigned int) floor(0.5 + sum[3] / sum[4]);
+
+		r = 0;
+		for (k = 0; k < np; k++) {
+			objs[l].score[k] = sum[5 + k];
+			if (sum[5 + k] > sum[5 + r])
+				r = k;
+		}
+		objs[l].sel_parallel = r;
+	}
+
+	qsort(objs, num_groups, sizeof(detected_object), &cmp_objects);
+	c->num_detected_objects = num_groups;
+	return TRUE;
+}
+
+void cascade_separate(cascade *c, unsigned int offset)
+{
+	if (c->num_jumbled_objects == 0)
+		return;
+
+	if (offset < c->num_jumbled_objects) {
+		qsort(&c->detected_objects[offset],
+		      c->num_jumbled_objects - offset,
+		      sizeof(detected_object), &cmp_objects);
+	}
+
+	if (c->min_neighbors > 0) {
+		if (separate_groups(c, c->detected_objects,
+		                    c->num_jumbled_objects))
+			return;
+	}
+
+	c->num_detected_objects = separate_greedy(c, c->detected_objects,
+	                                          c->num_jumbled_objects,
+	                                          TRUE);
+}
+
+/* Greedy suppression without the grid, to check and time it against */
+void cascade_separate_reference(cascade *c, unsigned int offset)
+{
+	if (c->num_jumbled_objects == 0)
+		return;
+
+	if (offset < c->num_jumbled_objects) {
+		qsort(&c->detected_objects[offset],
+		      c->num_jumbled_objects - offset,
+		      sizeof(detected_object), &cmp_objects);
+	}
+
+	c->num_detected_objects = separate_greedy(c, c->detected_objects,
+	                                          c->num_jumbled_objects,
+	                                          FALSE);
+}
+
+/* Scans count windows of a row, from the first-th one */
+static
+int cascade_scan_row(const cascade *c, cascade_worker *wk, cascade_task *t,
+                     const features *f, window *comp, unsigned int first,
+                     unsigned int count)
+{
+	unsigned int i, offset, num_windows;
+	double score;
+	detected_object *obj;
+	window inner;
+	int ret;
+
+	inner.top = comp->top - t->origin;
+	inner.width = c->levels[t->level].win_width;
+	inner.height = c->levels[t->level].win_height;
+	inner.left = first * t->istep;
+
+	num_windows = features_stddev_row(f, &inner, t->istep, count,
+	                                  c->min_stddev, wk->lefts,
+	                                  wk->factors);
+
+	ret = TRUE;
+	for (i = 0; i < num_windows; i++) {
+		comp->left = wk->lefts[i];
+		offset = inner.top * f->stride + comp->left;
+		obj = &t->objs[t->num_objects];
+		score = compiled_cascade_evaluate(&wk->cc, &f->sat[offset],
+		                                  wk->factors[i],
+		                                  c->multi_exit, obj->score,
+		                                  &obj->sel_parallel, NULL);
+		if (score >= 0.0) {
+			if (!new_object(c, t, comp))
+				ret = FALSE;
+		}
+	}
+	return ret;
+}
+
+/* Scaled features step by the scale, as a scan at step 1 would */
+static
+unsigned int cascade_fine_step(const cascade *c, const cascade_level *lvl)
+{
+	if (!(c->mode & CASCADE_MODE_SCALE))
+		return 1;
+	return MAX(1, (unsigned int) floor(0.5 + lvl->scale));
+}
+
+/*
+ * Evaluates the windows at step 1 that are closer to the window at comp
+ * than to any other window of the scan, so that every position is
+ * evaluated at most once.
+ */
+static
+int cascade_scan_near(const cascade *c, cascade_worker *wk, cascade_task *t,
+                      const features *f, const window *comp)
+{
+	unsigned int x, y, x0, x1, y0, y1, right, bottom, back, fine;
+	unsigned int left, offset;
+	const cascade_level *lvl;
+	double factor, score;
+	detected_object *obj;
+	window inner, near;
+	int ret;
+
+	lvl = &c->levels[t->level];
+	inner.width = lvl->win_width;
+	inner.height = lvl->win_height;
+	right = comp->width - inner.width;
+	bottom = comp->height - inner.height;
+
+	fine = cascade_fine_step(c, lvl);
+
+	/* the last window of a row or column also takes the positions
+	 * past it */
+	back = (t->istep - 1) / 2;
+	x0 = comp->left - MIN(comp->left, back);
+	y0 = comp->top - MIN(comp->top, back);
+	x0 = (x0 + fine - 1) / fine * fine;
+	y0 = (y0 + fine - 1) / fine * fine;
+	x1 = (comp->left + t->istep > right) ? right
+	     : comp->left + t->istep - 1 - back;
+	y1 = (comp->top + t->istep > bottom) ? bottom
+	     : comp->top + t->istep - 1 - back;
+
+	near = *comp;
+	ret = TRUE;
+	for (y = y0; y <= y1; y += fine) {
+		for (x = x0; x <= x1; x += fine) {
+			if (x == comp->left && y == comp->top) continue;
+
+			inner.left = x;
+			inner.top = y - t->origin;
+			if (!features_stddev_row(f, &inner, 1, 1, c->min_stddev,
+			                         &left, &factor))
+				continue;
+
+			offset = inner.top * f->stride + x;
+			obj = &t->objs[t->num_objects];
+			score = compiled_cascade_evaluate(&wk->cc,
+			                 &f->sat[offset], factor, c->multi_exit,
+			                 obj->score, &obj->sel_parallel, NULL);
+			if (score < 0.0) continue;
+
+			near.left = x;
+			near.top = y;
+			if (!new_object(c, t, &near))
+				ret = FALSE;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Scans a row like cascade_scan_row, except that a window rejected by
+ * the first stage with a score below -skip_margin skips the next
+ * skip_windows windows, and that one passing dense_depth stages has its
+ * neighbourhood searched at step 1. Windows failing the variance
+ * prefilter, or rejected by a threshold within the first stage, have no
+ * score to skip on, but still count as rejected at depth 0.
+ */
+static
+int cascade_scan_row_adaptive(const cascade *c, cascade_worker *wk,
+                              cascade_task *t, const features *f,
+                              window *comp)
+{
+	unsigned int i, col, offset, num_cols, num_windows, depth, next;
+	double score;
+	detected_object *obj;
+	window inner;
+	int ret;
+
+	inner.top = comp->top - t->origin;
+	inner.width = c->levels[t->level].win_width;
+	inner.height = c->levels[t->level].win_height;
+	inner.left = 0;
+
+	num_cols = (comp->width - inner.width) / t->istep + 1;
+	num_windows = features_stddev_row(f, &inner, t->istep, num_cols,
+	                                  c->min_stddev, wk->lefts,
+	                                  wk->factors);
+
+	ret = TRUE;
+	next = 0;
+	i = 0;
+	for (col = 0; col < num_cols; col++) {
+		comp->left = col * t->istep;
+		if (comp->left < next) continue;
+
+		while (i < num_windows && wk->lefts[i] < comp->left) i++;
+		if (i < num_windows && wk->lefts[i] == comp->left) {
+			offset = inner.top * f->stride + comp->left;
+			obj = &t->objs[t->num_objects];
+			score = compiled_cascade_evaluate(&wk->cc,
+			                 &f->sat[offset], wk->factors[i],
+			                 c->multi_exit, obj->score,
+			                 &obj->sel_parallel, &depth);
+			if (score >= 0.0) {
+				if (!new_object(c, t, comp))
+					ret = FALSE;
+			}
+		} else {
+			score = -HUGE_VAL;
+			depth = 0;
+		}
+
+		if (depth == 0 && score > -HUGE_VAL
+		    && score < -c->skip_margin) {
+			next = comp->left + (c->skip_windows + 1) * t->istep;
+		} else if (depth >= c->dense_depth && t->istep > 1) {
+			if (!cascade_scan_near(c, wk, t, f, comp))
+				ret = FALSE;
+		}
+	}
+	return ret;
+}
+
+/* Like cascade_scan_row, with lane groups aligned to the start of the
+ * row, so first has to be a multiple of COMPILED_LANES */
+static
+int cascade_scan_row_lanes(const cascade *c, cascade_worker *wk,
+                           cascade_task *t, const features *f,
+                           window *comp, unsigned int first,
+                           unsigned int count)
+{
+	double factor[COMPILED_LANES], val[COMPILED_LANES];
+	unsigned int sel[COMPILED_LANES];
+	unsigned int i, j, left, offset, num_lanes, mask, passed, np, istep;
+	unsigned int num_windows;
+	detected_object *obj;
+	window inner;
+	size_t size;
+	int ret;
+
+	np = c->num_parallels;
+	size = np * sizeof(double);
+	istep = t->istep;
+	inner.top = comp->top - t->origin;
+	inner.width = c->levels[t->level].win_width;
+	inner.height = c->levels[t->level].win_height;
+	inner.left = first * istep;
+
+	num_windows = features_stddev_row(f, &inner, istep, count,
+	                                  c->min_stddev, wk->lefts,
+	                                  wk->factors);
+
+	ret = TRUE;
+	i = 0;
+	while (i < num_windows) {
+		left = wk->lefts[i] - (wk->lefts[i] / istep) % COMPILED_LANES
+		       * istep;
+		num_lanes = MIN(COMPILED_LANES, first + count - left / istep);
+
+		mask = 0;
+		for (j = 0; j < num_lanes; j++)
+			factor[j] = 0;
+		for (; i < num_windows; i++) {
+			j = (wk->lefts[i] - left) / istep;
+			if (j >= num_lanes) break;
+
+			factor[j] = wk->factors[i];
+			mask |= 1u << j;
+		}
+
+		offset = inner.top * f->stride + left;
+		passed = compiled_cascade_evaluate_lanes(&wk->cc,
+		                 &f->sat[offset], istep, num_lanes,
+		                 mask, factor, c->multi_exit, val,
+		                 wk->lane_scores, sel);
+
+		for (j = 0; j < num_lanes; j++) {
+			if (!(passed & (1u << j))) continue;
+
+			obj = &t->objs[t->num_objects];
+			memcpy(obj->score, &wk->lane_scores[j * np], size);
+			obj->sel_parallel = sel[j];
+
+			comp->left = left + j * istep;
+			if (!new_object(c, t, comp))
+				ret = FALSE;
+		}
+	}
+	return ret;
+}
+
+static
+int cascade_grow_windows(cascade_worker *wk, unsigned int capacity)
+{
+	unsigned int *lefts;
+	double *factors;
+
+	if (wk->capacity_windows >= capacity)
+		return TRUE;
+
+	lefts = (unsigned int *) xmalloc(capacity * sizeof(unsigned int));
+	if (!lefts) return FALSE;
+
+	factors = (double *) xmalloc(capacity * sizeof(double));
+	if (!factors) {
+		free(lefts);
+		return FALSE;
+	}
+
+	if (wk->lefts) free(wk->lefts);
+	if (wk->factors) free(wk->factors);
+	wk->lefts = lefts;
+	wk->factors = factors;
+	wk->capacity_windows = capacity;
+	return TRUE;
+}
+
+static
+int cascade_grow_batch(cascade_worker *wk, unsigned int capacity,
+                       unsigned int num_parallels)
+{
+	size_t size;
+
+	if (!cascade_grow_windows(wk, capacity))
+		return FALSE;
+
+	if (wk->capacity_batch >= capacity)
+		return TRUE;
+
+	cascade_free_batch(wk);
+	size = capacity * sizeof(unsigned int);
+	wk->tops = (unsigned int *) xmalloc(size);
+	if (!wk->tops) goto error_allocate;
+
+	wk->offsets = (unsigned int *) xmalloc(size);
+	if (!wk->offsets) goto error_allocate;
+
+	wk->index = (unsigned int *) xmalloc(size);
+	if (!wk->index) goto error_allocate;
+
+	wk->sel = (unsigned int *) xmalloc(size);
+	if (!wk->sel) goto error_allocate;
+
+	size = capacity * num_parallels * sizeof(double);
+	wk->scores = (double *) xmalloc(size);
+	if (!wk->scores) goto error_allocate;
+
+	wk->capacity_batch = capacity;
+	return TRUE;
+
+error_allocate:
+	cascade_free_batch(wk);
+	return FALSE;
+}
+
+static
+int cascade_scan_breadth(const cascade *c, cascade_worker *wk,
+                         cascade_task *t, const features *f, window *comp)
+{
+	unsigned int i, j, np, count, num_windows, stage;
+	detected_object *obj;
+	window inner;
+	size_t size;
+	int ret;
+
+	np = c->num_parallels;
+	size = np * sizeof(double);
+	inner.width = c->levels[t->level].win_width;
+	inner.height = c->levels[t->level].win_height;
+	count = (comp->width - inner.width) / t->istep + 1;
+	if (!cascade_grow_batch(wk, t->num_rows * count, np))
+		return FALSE;
+
+	num_windows = 0;
+	for (i = 0; i < t->num_rows; i++) {
+		inner.top = comp->top + i * t->istep - t->origin;
+		inner.left = 0;
+		j = num_windows;
+		num_windows += features_stddev_row(f, &inner, t->istep, count,
+		                                   c->min_stddev,
+		                                   &wk->lefts[j],
+		                                   &wk->factors[j]);
+		for (; j < num_windows; j++) {
+			wk->tops[j] = comp->top + i * t->istep;
+			wk->offsets[j] = inner.top * f->stride + wk->lefts[j];
+			wk->index[j] = j;
+		}
+	}
+
+	memset(wk->scores, 0, num_windows * size);
+	for (stage = 0; stage < wk->cc.num_stages; stage++) {
+		if (num_windows == 0) break;
+		num_windows = compiled_cascade_evaluate_batch(&wk->cc, f->sat,
+		                      c->multi_exit, stage, num_windows,
+		                      wk->offsets, wk->factors, wk->index,
+		                      wk->scores, wk->sel);
+	}
+
+	ret = TRUE;
+	for (i = 0; i < num_windows; i++) {
+		j = wk->index[i];
+		obj = &t->objs[t->num_objects];
+		memcpy(obj->score, &wk->scores[i * np], size);
+		obj->sel_parallel = wk->sel[i];
+
+		comp->left = wk->lefts[j];
+		comp->top = wk->tops[j];
+		if (!new_object(c, t, comp))
+			ret = FALSE;
+	}
+	return ret;
+}
+
+static
+int cascade_grow_candidates(cascade_worker *wk, unsigned int capacity)
+{
+	if (wk->capacity_candidates >= capacity)
+		return TRUE;
+
+	if (wk->candidates) free(wk->candidates);
+	wk->candidates = (unsigned char *) xmalloc(capacity);
+	wk->capacity_candidates = (wk->candidates) ? capacity : 0;
+	return (wk->candidates != NULL);
+}
+
+/*
+ * First pass of the coarse-to-fine scan: the first coarse_stages stages
+ * (all if it is 0) are evaluated breadth-first over num_rows rows of
+ * windows at the scan step, and the survivors are marked in the
+ * candidate map, one byte per window.
+ */
+static
+int cascade_scan_coarse(const cascade *c, cascade_worker *wk,
+                        cascade_task *t, const features *f,
+                        const window *comp, unsigned int num_rows,
+                        unsigned int count)
+{
+	unsigned int i, j, np, num_windows, stage, num_stages;
+	window inner;
+
+	np = c->num_parallels;
+	if (!cascade_grow_batch(wk, num_rows * count, np))
+		return FALSE;
+	if (!cascade_grow_candidates(wk, num_rows * count))
+		return FALSE;
+
+	inner.width = c->levels[t->level].win_width;
+	inner.height = c->levels[t->level].win_height;
+	num_windows = 0;
+	for (i = 0; i < num_rows; i++) {
+		inner.top = comp->top + i * t->istep - t->origin;
+		inner.left = 0;
+		j = num_windows;
+		num_windows += features_stddev_row(f, &inner, t->istep, count,
+		                                   c->min_stddev,
+		                                   &wk->lefts[j],
+		                                   &wk->factors[j]);
+		for (; j < num_windows; j++) {
+			wk->tops[j] = i;
+			wk->offsets[j] = inner.top * f->stride + wk->lefts[j];
+			wk->index[j] = j;
+		}
+	}
+
+	num_stages = wk->cc.num_stages;
+	if (c->coarse_stages > 0)
+		num_stages = MIN(num_stages, c->coarse_stages);
+
+	memset(wk->scores, 0, num_windows * np * sizeof(double));
+	for (stage = 0; stage < num_stages; stage++) {
+		if (num_windows == 0) break;
+		num_windows = compiled_cascade_evaluate_batch(&wk->cc, f->sat,
+		                      c->multi_exit, stage, num_windows,
+		                      wk->offsets, wk->factors, wk->index,
+		                      wk->scores, wk->sel);
+	}
+
+	memset(wk->candidates, 0, num_rows * count);
+	for (i = 0; i < num_windows; i++) {
+		j = wk->index[i];
+		j = wk->tops[j] * count + wk->lefts[j] / t->istep;
+		wk->candidates[j] = 1;
+	}
+	return TRUE;
+}
+
+/*
+ * Second pass of the coarse-to-fine scan: every position at step 1
+ * whose cell of the coarse grid has a candidate at one of its corners
+ * is evaluated through the whole cascade. The band owns the rows from
+ * its first coarse row to the next band's one, so the candidate map
+ * covers that row too.
+ */
+static
+int cascade_scan_fine(const cascade *c, cascade_worker *wk, cascade_task *t,
+                      const features *f, window *comp, unsigned int num_rows,
+                      unsigned int count)
+{
+	unsigned int x, y, j, r, first, last, right, fine, left, offset;
+	const unsigned char *above, *below;
+	const cascade_level *lvl;
+	double factor, score;
+	detected_object *obj;
+	window inner;
+	int ret, hit;
+
+	lvl = &c->levels[t->level];
+	inner.width = lvl->win_width;
+	inner.height = lvl->win_height;
+	right = comp->width - inner.width;
+	fine = cascade_fine_step(c, lvl);
+
+	first = comp->top;
+	last = comp->height - inner.height;
+	if (num_rows > t->num_rows)
+		last = first + t->num_rows * t->istep - 1;
+
+	ret = TRUE;
+	for (y = (first + fine - 1) / fine * fine; y <= last; y += fine) {
+		r = (y - first) / t->istep;
+		above = &wk->candidates[r * count];
+		below = (r + 1 < num_rows) ? above + count : NULL;
+		if (!memchr(above, 1, count)
+		    && !(below && memchr(below, 1, count)))
+			continue;
+
+		inner.top = y - t->origin;
+		for (x = 0; x <= right; x += fine) {
+			j = x / t->istep;
+			hit = above[j] || (below && below[j]);
+			if (j + 1 < count)
+				hit = hit || above[j + 1]
+				      || (below && below[j + 1]);
+			if (!hit) continue;
+
+			inner.left = x;
+			if (!features_stddev_row(f, &inner, 1, 1, c->min_stddev,
+			                         &left, &factor))
+				continue;
+
+			offset = inner.top * f->stride + x;
+			obj = &t->objs[t->num_objects];
+			score = compiled_cascade_evaluate(&wk->cc,
+			                 &f->sat[offset], factor, c->multi_exit,
+			                 obj->score, &obj->sel_parallel, NULL);
+			if (score < 0.0) continue;
+
+			comp->left = x;
+			comp->top = y;
+			if (!new_object(c, t, comp))
+				ret = FALSE;
+		}
+	}
+	return ret;
+}
+
+static
+int cascade_scan_two_pass(const cascade *c, cascade_worker *wk,
+                          cascade_task *t, const features *f, window *comp)
+{
+	const cascade_level *lvl;
+	unsigned int count, num_rows, next;
+
+	lvl = &c->levels[t->level];
+	count = (comp->width - lvl->win_width) / t->istep + 1;
+	num_rows = t->num_rows;
+	next = comp->top + t->num_rows * t->istep;
+	if (next + lvl->win_height <= comp->height)
+		num_rows++;
+
+	if (!cascade_scan_coarse(c, wk, t, f, comp, num_rows, count))
+		return FALSE;
+	return cascade_scan_fine(c, wk, t, f, comp, num_rows, count);
+}
+
+/*
+ * Number of windows per row of a tile, chosen so that the rows of the
+ * integral images that a tile's windows touch, and the ones the next
+ * row of windows brings in, fill at most half of the L2 cache. Tiles
+ * are whole lane groups wide, so that the SIMD scan is unchanged.
+ */
+static
+unsigned int cascade_tile_columns(const cascade *c, const cascade_task *t,
+                                  unsigned int count)
+{
+	const cascade_level *lvl;
+	size_t row_size, width;
+	unsigned int cols;
+
+	if (!(c->mode & CASCADE_MODE_TILED))
+		return count;
+
+	lvl = &c->levels[t->level];
+	row_size = (lvl->win_height + 1 + t->istep)
+	           * (sizeof(sval) + sizeof(sval2));
+	width = cpu_cache_size() / 2 / row_size;
+	cols = 1;
+	if (width > lvl->win_width)
+		cols = (unsigned int) ((width - lvl->win_width) / t->istep + 1);
+
+	cols = MAX(COMPILED_LANES, cols - cols % COMPILED_LANES);
+	return MIN(cols, count);
+}
+
+static
+int cmp_positions(const void *ptr1, const void *ptr2)
+{
+	const detected_object *o1 = (const detected_object *) ptr1;
+	const detected_object *o2 = (const detected_object *) ptr2;
+
+	if (o1->w.top != o2->w.top)
+		return (o1->w.top < o2->w.top) ? -1 : +1;
+	if (o1->w.left != o2->w.left)
+		return (o1->w.left < o2->w.left) ? -1 : +1;
+	return 0;
+}
+
+static
+int cascade_run_task(const cascade *c, cascade_worker *wk, cascade_task *t)
+{
+	const cascade_level *lvl;
+	unsigned int i, num_rows, back, extra, count, first, cols, num;
+	const features *f;
+	window comp;
+	int ret;
+
+	lvl = &c->levels[t->level];
+	t->num_objects = 0;
+	comp = t->comp;
+
+	if (!cascade_grow_windows(wk, comp.width / t->istep + 1))
+		return FALSE;
+
+	if ((c->mode & CASCADE_MODE_SCALE)
+	    && !(c->mode & CASCADE_MODE_STREAM)) {
+		f = &c->f;
+		t->origin = 0;
+		if (!compiled_cascade_precomp_scaled(&wk->cc, f->stride,
+		                                     lvl->scale, lvl->win_width,
+		                                     lvl->win_height))
+			return FALSE;
+	} else {
+		/* the adaptive and coarse-to-fine scans reach past the band */
+		back = extra = 0;
+		if (c->mode & CASCADE_MODE_COARSE) {
+			extra = t->istep;
+		} else if (c->mode & CASCADE_MODE_ADAPTIVE) {
+			back = MIN(comp.top, (t->istep - 1) / 2);
+			extra = t->istep - 1;
+		}
+
+		/* streamed scaled features take their strip of the source
+		 * image, which a level spans at its full size */
+		num_rows = (t->num_rows - 1) * t->istep + lvl->win_height;
+		num_rows = MIN(num_rows + extra, comp.height - comp.top + back);
+		if (!features_precompute_resized(&wk->f, lvl->base, comp.width,
+		                                 comp.height, comp.top - back,
+		                                 num_rows))
+			return FALSE;
+
+		f = &wk->f;
+		t->origin = comp.top - back;
+		if (c->mode & CASCADE_MODE_SCALE) {
+			if (!compiled_cascade_precomp_scaled(&wk->cc, f->stride,
+			                                     lvl->scale,
+			                                     lvl->win_width,
+			                                     lvl->win_height))
+				return FALSE;
+		} else {
+			if (!compiled_cascade_precomp(&wk->cc, f->stride))
+				return FALSE;
+		}
+	}
+
+	compiled_cascade_set_fixed(&wk->cc,
+	                          (c->mode & CASCADE_MODE_FIXED) != 0);
+	compiled_cascade_set_generated(&wk->cc, c->generated);
+	if (c->mode & CASCADE_MODE_COARSE)
+		return cascade_scan_two_pass(c, wk, t, f, &comp);
+
+	/* the adaptive scan decides window by window, so it takes
+	 * precedence over the breadth-first and SIMD scans */
+	if ((c->mode & CASCADE_MODE_BREADTH)
+	    && !(c->mode & CASCADE_MODE_ADAPTIVE))
+		return cascade_scan_breadth(c, wk, t, f, &comp);
+
+	ret = TRUE;
+	if (c->mode & CASCADE_MODE_ADAPTIVE) {
+		for (i = 0; i < t->num_rows; i++) {
+			if (!cascade_scan_row_adaptive(c, wk, t, f, &comp))
+				ret = FALSE;
+			comp.top += t->istep;
+		}
+
+		/* neighbourhoods reach back a row, so the windows are put
+		 * back in the order of a scan by rows for the grouping */
+		qsort(t->objs, t->num_objects, sizeof(detected_object),
+		      &cmp_positions);
+		return ret;
+	}
+
+	/* tiles are scanned from top to bottom one after the other, and
+	 * their windows put back in the order of a scan by rows */
+	count = (comp.width - lvl->win_width) / t->istep + 1;
+	cols = cascade_tile_columns(c, t, count);
+	for (first = 0; first < count; first += num) {
+		num = MIN(cols, count - first);
+		comp.top = t->comp.top;
+		for (i = 0; i < t->num_rows; i++) {
+			if (c->mode & CASCADE_MODE_SIMD) {
+				if (!cascade_scan_row_lanes(c, wk, t, f, &comp,
+				                            first, num))
+					ret = FALSE;
+			} else {
+				if (!cascade_scan_row(c, wk, t, f, &comp,
+				                      first, num))
+					ret = FALSE;
+			}
+			comp.top += t->istep;
+		}
+	}
+
+	if (cols < count) {
+		qsort(t->objs, t->num_objects, sizeof(detected_object),
+		      &cmp_positions);
+	}
+	return ret;
+}
+
+static
+void cascade_worker_job(void *arg)
+{
+	cascade_worker *wk;
+	cascade_task *t;
+	unsigned int idx;
+	double cpu_time;
+	stopwatch sw;
+	cascade *c;
+
+	wk = (cascade_worker *) arg;
+	c = wk->c;
+	while (TRUE) {
+		idx = __sync_fetch_and_add(&c->next_task, 1);
+		if (idx >= c->num_tasks) break;
+
+		t = c->schedule[idx];
+		stopwatch_start(&sw);
+		t->success = cascade_run_task(c, wk, t);
+		stopwatch_stop(&sw, &t->elapsed, &cpu_time);
+	}
+}
 
-	istep = c->step;
+static
+int cascade_allocate_workers(cascade *c, unsigned int num_workers)
+{
+	cascade_worker *workers, *wk;
+	size_t size;
+
+	if (c->num_workers >= num_workers)
+		return TRUE;
+
+	size = num_workers * sizeof(cascade_worker);
+	workers = (cascade_worker *) xmalloc(size);
+	if (!workers) return FALSE;
+
+	if (c->workers) {
+		size = c->num_workers * sizeof(cascade_worker);
+		memcpy(workers, c->workers, size);
+		free(c->workers);
+	}
+	c->workers = workers;
+
+	while (c->num_workers < num_workers) {
+		wk = &workers[c->num_workers++];
+		wk->c = c;
+		features_init(&wk->f);
+		compiled_cascade_init(&wk->cc);
+		wk->lefts = NULL;
+		wk->factors = NULL;
+		wk->capacity_windows = 0;
+		wk->tops = NULL;
+		wk->offsets = NULL;
+		wk->index = NULL;
+		wk->sel = NULL;
+		wk->scores = NULL;
+		wk->capacity_batch = 0;
+		wk->candidates = NULL;
+		wk->capacity_candidates = 0;
+
+		size = COMPILED_LANES * c->num_parallels * sizeof(double);
+		wk->lane_scores = (double *) xmalloc(size);
+		if (!wk->lane_scores) return FALSE;
+	}
+
+	c->views_generation = 0;
+	return TRUE;
+}
+
+/* Refreshes the workers' views after the model was (re)compiled */
+static
+int cascade_share_workers(cascade *c)
+{
+	const cascade *model;
+	unsigned int k;
+
+	model = (c->model) ? c->model : c;
+	if (c->views_generation == model->generation)
+		return TRUE;
+
+	for (k = 0; k < c->num_workers; k++) {
+		if (!compiled_cascade_share(&model->cc, &c->workers[k].cc))
+			return FALSE;
+	}
+	c->views_generation = model->generation;
+	return TRUE;
+}
+
+static
+cascade_task *cascade_new_task(cascade *c)
+{
+	cascade_task *tasks, **schedule;
+	unsigned int capacity;
+	size_t size;
+
+	if (c->num_tasks >= c->capacity_tasks) {
+		capacity = MAX(2 * c->capacity_tasks, 32);
+		size = capacity * sizeof(cascade_task *);
+		schedule = (cascade_task **) xmalloc(size);
+		if (!schedule) return NULL;
+
+		if (c->schedule) free(c->schedule);
+		c->schedule = schedule;
+
+		size = capacity * sizeof(cascade_task);
+		tasks = (cascade_task *) xmalloc(size);
+		if (!tasks) return NULL;
+
+		if (c->tasks) {
+			size = c->capacity_tasks * sizeof(cascade_task);
+			memcpy(tasks, c->tasks, size);
+			free(c->tasks);
+		}
+		c->tasks = tasks;
+
+		while (c->capacity_tasks < capacity) {
+			cascade_task *t = &tasks[c->capacity_tasks++];
+			t->objs = NULL;
+			t->scores = NULL;
+			t->capacity_objects = 0;
+			if (!grow_objects(&t->objs, &t->scores,
+			                  &t->capacity_objects, TASK_ALLOC_NUM,
+			                  c->num_parallels))
+				return NULL;
+		}
+	}
+	return &c->tasks[c->num_tasks++];
+}
+
+static
+int cascade_allocate_levels(cascade *c, unsigned int num_levels)
+{
+	cascade_level *levels;
+	size_t size;
+
+	if (c->capacity_levels >= num_levels)
+		return TRUE;
+
+	size = num_levels * sizeof(cascade_level);
+	levels = (cascade_level *) xmalloc(size);
+	if (!levels) return FALSE;
+
+	if (c->levels) {
+		size = c->capacity_levels * sizeof(cascade_level);
+		memcpy(levels, c->levels, size);
+		free(c->levels);
+	}
+	c->levels = levels;
+
+	while (c->capacity_levels < num_levels)
+		levels[c->capacity_levels++].window_cost = 0;
+	return TRUE;
+}
+
+static
+int cascade_measure_levels(cascade *c)
+{
+	unsigned int i, istep, num_cols;
+	double step, width, height, scale;
+	cascade_level *lvl;
+
+	if (!cascade_allocate_levels(c, c->pyramid_max))
+		return FALSE;
 
-	width = comp.width;
-	height = comp.height;
-	step = istep;
+	width = c->src->width;
+	height = c->src->height;
+	step = c->step;
+	scale = 1;
 
 	for (i = 0; i < c->pyramid_min; i++) {
 		step /= c->scale;
 		width /= c->scale;
 		height /= c->scale;
+		scale *= c->scale;
 	}
 
-	error = FALSE;
 	for (; i < c->pyramid_max; i++) {
-		comp.width = (unsigned int) floor(0.5 + width);
-		comp.height = (unsigned int) floor(0.5 + height);
+		lvl = &c->levels[i];
+		lvl->comp.left = 0;
+		lvl->comp.top = 0;
+		lvl->comp.width = (unsigned int) floor(0.5 + width);
+		lvl->comp.height = (unsigned int) floor(0.5 + height);
+		lvl->base = c->src;
+		lvl->win_width = c->width;
+		lvl->win_height = c->height;
+		lvl->scale = scale;
 		istep = (unsigned int) ceil(step);
 
+		if (c->mode & CASCADE_MODE_SCALE) {
+			lvl->comp.width = c->src->width;
+			lvl->comp.height = c->src->height;
+			lvl->win_width = (unsigned int)
+			                   floor(0.5 + scale * c->width);
+			lvl->win_height = (unsigned int)
+			                   floor(0.5 + scale * c->height);
+			istep = (unsigned int) floor(0.5 + scale * istep);
+		}
+
 		step /= c->scale;
 		width /= c->scale;
 		height /= c->scale;
+		scale *= c->scale;
+
+		lvl->istep = istep;
+		lvl->elapsed = 0;
+		if (lvl->comp.width < lvl->win_width
+		    || lvl->comp.height < lvl->win_height) {
+			lvl->num_rows = 0;
+			lvl->num_windows = 0;
+			continue;
+		}
+
+		lvl->num_rows = (lvl->comp.height - lvl->win_height) / istep + 1;
+		num_cols = (lvl->comp.width - lvl->win_width) / istep + 1;
+		lvl->num_windows = ((double) lvl->num_rows) * num_cols;
+	}
+	return TRUE;
+}
+
+/*
+ * Halves the source image into octaves until the next one would be
+ * smaller than a level, so that each level is resized from the nearest
+ * larger image instead of the source. With an arena, the levels are
+ * also resized up front into one contiguous buffer.
+ */
+static
+int cascade_build_pyramid(cascade *c)
+{
+	unsigned int i;
+	size_t size;
+	const image *base;
+	cascade_level *lvl;
+	unsigned char *pixels;
+
+	c->num_octaves = 0;
+	base = c->src;
+	size = 0;
+	for (i = c->pyramid_min; i < c->pyramid_max; i++) {
+		lvl = &c->levels[i];
+		if (lvl->num_rows == 0) continue;
+
+		while (c->num_octaves < CASCADE_MAX_OCTAVES
+		       && base->width / 2 >= lvl->comp.width
+		       && base->height / 2 >= lvl->comp.height) {
+			if (!image_halve(base, &c->octaves[c->num_octaves]))
+				return FALSE;
+			base = &c->octaves[c->num_octaves++];
+		}
+		lvl->base = base;
+		size += ((size_t) lvl->comp.width) * lvl->comp.height;
+	}
+
+	if (!c->pyramid_arena) return TRUE;
 
-		if (!image_resize(c->src, &c->img,
-		                  comp.width, comp.height))
+	if (c->capacity_arena < size) {
+		if (c->arena) free(c->arena);
+		c->arena = (unsigned char *) xmalloc(size);
+		if (!c->arena) {
+			c->capacity_arena = 0;
 			return FALSE;
-		if (!features_precompute(&c->f, &c->img))
+		}
+		c->capacity_arena = size;
+	}
+
+	pixels = c->arena;
+	for (i = c->pyramid_min; i < c->pyramid_max; i++) {
+		lvl = &c->levels[i];
+		if (lvl->num_rows == 0) continue;
+
+		image_view(&lvl->img, pixels, lvl->comp.width,
+		           lvl->comp.height);
+		if (!image_resize(lvl->base, &lvl->img, lvl->comp.width,
+		                  lvl->comp.height))
 			return FALSE;
+		lvl->base = &lvl->img;
+		pixels += lvl->img.capacity;
+	}
+	return TRUE;
+}
 
-		cascade_precomp(c, c->f.stride);
-		comp.top = 0;
-		while (comp.top <= comp.height - c->height) {
-			comp.left = 0;
-			while (comp.left <= comp.width - c->width) {
-				inner.left = comp.left;
-				inner.top = comp.top;
-				stddev = features_stddev(&c->f, &inner);
-				if (stddev <= c->min_stddev) {
-					comp.left += istep;
-					continue;
-				}
+static
+int cmp_tasks(const void *ptr1, const void *ptr2)
+{
+	const cascade_task *t1 = *((const cascade_task **) ptr1);
+	const cascade_task *t2 = *((const cascade_task **) ptr2);
+	if (t1->cost < t2->cost) return +1;
+	if (t1->cost > t2->cost) return -1;
+	if (t1 < t2) return -1;
+	if (t1 > t2) return +1;
+	return 0;
+}
 
-				factor = stddev;
-				offset = inner.top * c->f.stride + inner.left;
-				score = cascade_evaluate(c, offset,
-				                         c->f.stride, factor);
-				if (score >= 0.0) {
-					{
-						if (!new_object(c, &comp))
-							error = TRUE;
-					}
-				}
-				comp.left += istep;
-			}
-			comp.top += istep;
+static
+int cascade_split_levels(cascade *c, unsigned int num_workers)
+{
+	unsigned int i, num_rows, min_rows, band_rows, num_known;
+	unsigned int strip, strip_rows;
+	double window_cost, row_cost, total, target;
+	cascade_level *lvl;
+	cascade_task *t;
+	window comp;
+
+	if (!cascade_measure_levels(c))
+		return FALSE;
+
+	num_known = 0;
+	window_cost = 0;
+	for (i = c->pyramid_min; i < c->pyramid_max; i++) {
+		if (c->levels[i].window_cost > 0) {
+			window_cost += c->levels[i].window_cost;
+			num_known++;
+		}
+	}
+	window_cost = (num_known > 0) ? window_cost / num_known : 1;
+
+	total = 0;
+	for (i = c->pyramid_min; i < c->pyramid_max; i++) {
+		lvl = &c->levels[i];
+		if (lvl->window_cost > 0)
+			total += lvl->num_windows * lvl->window_cost;
+		else
+			total += lvl->num_windows * window_cost;
+	}
+	target = total / (num_workers * TASKS_PER_WORKER);
+
+	c->num_tasks = 0;
+	for (i = c->pyramid_min; i < c->pyramid_max; i++) {
+		lvl = &c->levels[i];
+		num_rows = lvl->num_rows;
+		if (num_rows == 0) continue;
+
+		row_cost = lvl->num_windows / num_rows;
+		row_cost *= (lvl->window_cost > 0) ? lvl->window_cost
+		                                   : window_cost;
+
+		band_rows = num_rows;
+		if (num_workers > 1 && row_cost > 0) {
+			min_rows = BAND_MIN_HEIGHT * lvl->win_height;
+			min_rows = (min_rows + lvl->istep - 1) / lvl->istep;
+			band_rows = (unsigned int) ceil(target / row_cost);
+			band_rows = MAX(band_rows, min_rows);
+		}
+
+		/* streamed bands only need integral images as tall as a
+		 * strip, which overlaps the next one by a window less a step */
+		if (c->mode & CASCADE_MODE_STREAM) {
+			strip = c->strip_height;
+			if (strip == 0)
+				strip = BAND_MIN_HEIGHT * lvl->win_height;
+			strip_rows = 1;
+			if (strip > lvl->win_height)
+				strip_rows += (strip - lvl->win_height)
+				              / lvl->istep;
+			band_rows = MIN(band_rows, strip_rows);
+		}
+
+		comp = lvl->comp;
+		while (num_rows > 0) {
+			t = cascade_new_task(c);
+			if (!t) return FALSE;
+
+			t->comp = comp;
+			t->level = i;
+			t->istep = lvl->istep;
+			t->num_rows = MIN(band_rows, num_rows);
+			t->cost = t->num_rows * row_cost;
+			t->elapsed = 0;
+
+			num_rows -= t->num_rows;
+			comp.top += t->num_rows * lvl->istep;
+		}
+	}
+
+	for (i = 0; i < c->num_tasks; i++)
+		c->schedule[i] = &c->tasks[i];
+
+	qsort(c->schedule, c->num_tasks, sizeof(cascade_task *), &cmp_tasks);
+	return TRUE;
+}
+
+static
+void cascade_update_costs(cascade *c)
+{
+	unsigned int i;
+	cascade_level *lvl;
+	double window_cost;
+
+	for (i = 0; i < c->num_tasks; i++)
+		c->levels[c->tasks[i].level].elapsed += c->tasks[i].elapsed;
+
+	for (i = c->pyramid_min; i < c->pyramid_max; i++) {
+		lvl = &c->levels[i];
+		if (lvl->num_windows == 0 || lvl->elapsed <= 0) continue;
+
+		window_cost = lvl->elapsed / lvl->num_windows;
+		if (lvl->window_cost > 0)
+			lvl->window_cost = 0.5 * (lvl->window_cost + window_cost);
+		else
+			lvl->window_cost = window_cost;
+	}
+}
+
+static
+detected_object *cascade_push_object(cascade *c)
+{
+	if (c->num_jumbled_objects >= c->capacity_objects - 1) {
+		if (!grow_objects(&c->detected_objects, &c->scores,
+		                  &c->capacity_objects,
+		                  2 * c->capacity_objects, c->num_parallels))
+			return NULL;
+	}
+	return &c->detected_objects[c->num_jumbled_objects++];
+}
+
+static
+int cascade_merge_tasks(cascade *c)
+{
+	unsigned int i, j, np;
+	detected_object *obj;
+	const cascade_task *t;
+	size_t size;
+	int ret;
+
+	np = c->num_parallels;
+	size = np * sizeof(double);
+
+	ret = TRUE;
+	for (i = 0; i < c->num_tasks; i++) {
+		t = &c->tasks[i];
+		if (!t->success) ret = FALSE;
+
+		for (j = 0; j < t->num_objects; j++) {
+			obj = cascade_push_object(c);
+			if (!obj) return FALSE;
+
+			obj->w = t->objs[j].w;
+			obj->comp = t->objs[j].comp;
+			obj->sel_parallel = t->objs[j].sel_parallel;
+			memcpy(obj->score, t->objs[j].score, size);
+		}
+	}
+	return ret;
+}
+
+/* Adds a jumbled object, scored by the first parallel, as detection
+ * would before cascade_separate */
+int cascade_add_object(cascade *c, const window *w, double score)
+{
+	detected_object *obj;
+	unsigned int k;
+
+	obj = cascade_push_object(c);
+	if (!obj) return FALSE;
+
+	obj->w = *w;
+	obj->comp = *w;
+	obj->sel_parallel = 0;
+	obj->score[0] = score;
+	for (k = 1; k < c->num_parallels; k++)
+		obj->score[k] = -HUGE_VAL;
+	return TRUE;
+}
+
+static
+int cascade_find_generated(cascade *c)
+{
+	const generated_cascade *gc;
+	const cascade *model;
+
+	c->generated = NULL;
+	if (!(c->mode & CASCADE_MODE_GENERATED))
+		return TRUE;
+
+	/* the adaptive scan needs the depth, which the generated code
+	 * doesn't report, and the coarse pass is evaluated in batches */
+	if (c->mode & (CASCADE_MODE_SIMD | CASCADE_MODE_SCALE
+	               | CASCADE_MODE_BREADTH | CASCADE_MODE_FIXED
+	               | CASCADE_MODE_ADAPTIVE | CASCADE_MODE_COARSE)) {
+		error("compiled-in cascades only evaluate one window at a "
+		      "time on the image pyramid");
+		return FALSE;
+	}
+
+	model = (c->model) ? c->model : c;
+	gc = generated_find(compiled_cascade_fingerprint(&model->cc));
+	if (!gc) {
+		error("no cascade compiled into the program matches this one");
+		return FALSE;
+	}
+	c->generated = gc;
+	return TRUE;
+}
+
+int cascade_detect(cascade *c, int separate_detected)
+{
+	unsigned int i, num_workers, running;
+
+	c->num_detected_objects = 0;
+	c->num_jumbled_objects = 0;
+
+	if (c->model) {
+		if (!c->model->compiled) {
+			error("the shared cascade is not compiled");
+			return FALSE;
+		}
+	} else if (!c->compiled) {
+		if (!cascade_compile(c))
+			return FALSE;
+	}
+
+	if (!cascade_find_generated(c))
+		return FALSE;
+
+	num_workers = (c->tp) ? MAX(1, c->tp->num_threads) : 1;
+	if (!cascade_allocate_workers(c, num_workers))
+		return FALSE;
+
+	if (!cascade_share_workers(c))
+		return FALSE;
+
+	if (!cascade_split_levels(c, num_workers))
+		return FALSE;
+
+	/* the arena holds levels resized from the octaves, so it implies
+	 * the pyramid */
+	if (((c->mode & CASCADE_MODE_PYRAMID) || c->pyramid_arena)
+	    && !(c->mode & CASCADE_MODE_SCALE)) {
+		if (!cascade_build_pyramid(c))
+			return FALSE;
+	}
+
+	if ((c->mode & CASCADE_MODE_SCALE)
+	    && !(c->mode & CASCADE_MODE_STREAM)) {
+		if (!features_precompute_strips(&c->f, c->src, c->tp,
+		                                num_workers))
+			return FALSE;
+	}
+
+	/* the pool may hold other jobs, such as a detector's */
+	c->next_task = 0;
+	if (c->tp && num_workers > 1) {
+		running = 0;
+		for (i = 0; i < num_workers; i++) {
+			if (!thread_pool_enqueue_count(c->tp,
+			                               &cascade_worker_job,
+			                               &c->workers[i], &running))
+				cascade_worker_job(&c->workers[i]);
 		}
+		thread_pool_wait_count(c->tp, &running);
+	} else {
+		cascade_worker_job(&c->workers[0]);
 	}
 
-	if (error) return FALSE;
+	cascade_update_costs(c);
+
+	if (!cascade_merge_tasks(c))
+		return FALSE;
+
 	if (separate_detected)
 		cascade_separate(c, 0);
 	return TRUE;
@@ -702,6 +2554,98 @@ int cascade_extract(cascade *c, const window *comp, sval *sat)
 	return TRUE;
 }
 
+static
+int read_reject(FILE *fp, double *reject)
+{
+	int ch;
+
+	do {
+		ch = getc(fp);
+	} while (ch == ' ' || ch == '\t');
+
+	if (ch == '\n' || ch == '\r' || ch == EOF) {
+		*reject = -HUGE_VAL;
+		return TRUE;
+	}
+
+	ungetc(ch, fp);
+	return (fscanf(fp, "%lg", reject) == 1);
+}
+
+/*
+ * The compiled arrays are used straight from the mapping, and the
+ * stages are rebuilt from them only for training and saving.
+ */
+static
+int cascade_load_binary(cascade *c, const char *filename, int reset)
+{
+	const cascade_file_header *hdr;
+	const double *cl_intercept;
+	compiled_cascade cc;
+	unsigned int i, g, k;
+	cascade_stage *st;
+	classifier *cl;
+
+	if (reset)
+		cascade_reset(c);
+
+	compiled_cascade_init(&cc);
+	if (!cascade_file_map(&cc, filename, &hdr, &cl_intercept))
+		goto error_load;
+
+	if (reset) {
+		if (!cascade_init(c, hdr->width, hdr->height,
+		                  hdr->num_parallels))
+			goto error_load;
+	} else {
+		if (c->width != hdr->width || c->height != hdr->height
+		    || c->num_parallels != hdr->num_parallels) {
+			error("wrong parameters for cascade load");
+			goto error_load;
+		}
+		cascade_clear(c);
+	}
+
+	c->scale = hdr->scale;
+	c->min_stddev = hdr->min_stddev;
+	c->step = hdr->step;
+	c->match_thresh = hdr->match_thresh;
+	c->overlap_thresh = hdr->overlap_thresh;
+	c->multi_exit = hdr->multi_exit;
+
+	g = 0;
+	while (g < cc.num_groups) {
+		st = cascade_new_stage(c);
+		if (!st) goto error_load;
+
+		for (k = 0; k < c->num_parallels; k++, g++) {
+			for (i = cc.first_classifier[g];
+			     i < cc.first_classifier[g + 1]; i++) {
+				cl = cascade_new_classifier(c, st, k);
+				if (!cl) goto error_load;
+
+				cl->fi = cc.fi[i];
+				cl->coef = cc.coef[i];
+				cl->thresh = cc.thresh[i];
+				cl->intercept = cl_intercept[i];
+				cl->reject = cc.reject[i];
+			}
+		}
+		cascade_consolidate_stage(c, st);
+	}
+
+	compiled_cascade_cleanup(&c->cc);
+	c->cc = cc;
+	c->generation++;
+	c->compiled = TRUE;
+	return TRUE;
+
+error_load:
+	compiled_cascade_cleanup(&cc);
+	if (reset) cascade_cleanup(c);
+	return FALSE;
+}
+
 int cascade_load(cascade *c, const char *filename, int reset)
 {
 	unsigned int width, height;
@@ -712,6 +2656,9 @@ int cascade_load(cascade *c, const char *filename, int reset)
 	classifier *cl;
 	FILE *fp = NULL;
 
+	if (cascade_file_is_binary(filename))
+		return cascade_load_binary(c, filename, reset);
+
 	if (reset)
 		cascade_reset(c);
 
@@ -767,6 +2714,9 @@ int cascade_load(cascade *c, const char *filename, int reset)
 				           &cl->fi.w.left, &cl->fi.w.top,
 				           &cl->fi.w.width, &cl->fi.w.height)
 				    != 8) goto error_parse;
+
+				if (!read_reject(fp, &cl->reject))
+					goto error_parse;
 			}
 		}
 		cascade_consolidate_stage(c, st);
@@ -797,8 +2747,9 @@ int cascade_save(const cascade *c, const char *filename)
 		return FALSE;
 	}
 	fprintf(fp, "%u %u %u\n", c->width, c->height, c->num_parallels);
-	fprintf(fp, "%g %g %u %g %g\n", c->scale, c->min_stddev, c->step,
-	        c->match_thresh, c->overlap_thresh);
+	/* doubles are written with enough digits to read back exactly */
+	fprintf(fp, "%.17g %.17g %u %.17g %.17g\n", c->scale, c->min_stddev,
+	        c->step, c->match_thresh, c->overlap_thresh);
 	fprintf(fp, "%d\n", c->multi_exit);
 
 	fprintf(fp, "%u\n", c->num_stages);
@@ -806,11 +2757,14 @@ int cascade_save(const cascade *c, const char *filename)
 		for (k = 0; k < c->num_parallels; k++) {
 			fprintf(fp, "%u\n", st->num_classifiers[k]);
 			for (cl = st->cl[k]; cl; cl = cl->next) {
-				fprintf(fp, "%g %g %g %u %u %u %u %u\n",
+				fprintf(fp, "%.17g %.17g %.17g %u %u %u %u %u",
 				        cl->coef, cl->thresh, cl->intercept,
 				        cl->fi.idx, cl->fi.w.left,
 				        cl->fi.w.top, cl->fi.w.width,
 				        cl->fi.w.height);
+				if (cl->reject > -HUGE_VAL)
+					fprintf(fp, " %.17g", cl->reject);
+				fprintf(fp, "\n");
 			}
 		}
 	}
@@ -818,3 +2772,47 @@ int cascade_save(const cascade *c, const char *filename)
 	return TRUE;
 }
 
+int cascade_save_binary(const cascade *c, const char *filename)
+{
+	cascade_file_header params;
+	double *cl_intercept;
+	compiled_cascade cc;
+	cascade_stage *st;
+	classifier *cl;
+	unsigned int i, k;
+	int ret;
+
+	compiled_cascade_init(&cc);
+	if (!compile_stages(c, &cc))
+		return FALSE;
+
+	cl_intercept = (double *)
+	    xmalloc((cc.num_classifiers + 1) * sizeof(double));
+	if (!cl_intercept) {
+		compiled_cascade_cleanup(&cc);
+		return FALSE;
+	}
+
+	i = 0;
+	for (st = c->st; st; st = st->next) {
+		for (k = 0; k < c->num_parallels; k++) {
+			for (cl = st->cl[k]; cl; cl = cl->next)
+				cl_intercept[i++] = cl->intercept;
+		}
+	}
+
+	memset(&params, 0, sizeof(cascade_file_header));
+	params.width = c->width;
+	params.height = c->height;
+	params.step = c->step;
+	params.multi_exit = c->multi_exit;
+	params.scale = c->scale;
+	params.min_stddev = c->min_stddev;
+	params.match_thresh = c->match_thresh;
+	params.overlap_thresh = c->overlap_thresh;
+
+	ret = cascade_file_write(&cc, &params, cl_intercept, filename);
+	free(cl_intercept);
+	compiled_cascade_cleanup(&cc);
+	return ret;
+}
@@ -2,9 +2,24 @@
 #ifndef __CASCADE_H
 #define __CASCADE_H
 
+#include "compiled_cascade.h"
 #include "features.h"
 #include "image.h"
 #include "window.h"
+#include "thread_pool.h"
+
+#define CASCADE_MODE_SIMD         1
+#define CASCADE_MODE_SCALE        2
+#define CASCADE_MODE_BREADTH      4
+#define CASCADE_MODE_FIXED        8
+#define CASCADE_MODE_GENERATED   16
+#define CASCADE_MODE_ADAPTIVE    32
+#define CASCADE_MODE_COARSE      64
+#define CASCADE_MODE_TILED      128
+#define CASCADE_MODE_STREAM     256
+#define CASCADE_MODE_PYRAMID    512
+
+#define CASCADE_MAX_OCTAVES      16
 
 /* Data structures */
 typedef
@@ -13,13 +28,14 @@ struct classifier_st {
 	feature_index fi;
 	feature_index_opt fo;
 	double coef, intercept, thresh;
+	double reject;
 } classifier;
 
 typedef
 struct cascade_stage_st {
 	struct cascade_stage_st *next, *prev;
 	unsigned int *num_classifiers;
-	classifier **cl;
+	classifier **cl, **last;
 	double *intercept;
 } cascade_stage;
 
@@ -31,6 +47,47 @@ struct detected_object_st {
 	double *score;
 } detected_object;
 
+typedef
+struct cascade_worker_st {
+	struct cascade_st *c;
+	features f;
+	compiled_cascade cc;
+	double *lane_scores;
+	unsigned int *lefts;
+	double *factors;
+	unsigned int capacity_windows;
+	unsigned int *tops, *offsets, *index, *sel;
+	double *scores;
+	unsigned int capacity_batch;
+	unsigned char *candidates;
+	unsigned int capacity_candidates;
+} cascade_worker;
+
+typedef
+struct cascade_level_st {
+	window comp;
+	const image *base;
+	image img;
+	unsigned int istep, num_rows;
+	unsigned int win_width, win_height;
+	double scale;
+	double num_windows;
+	double window_cost, elapsed;
+} cascade_level;
+
+typedef
+struct cascade_task_st {
+	window comp;
+	unsigned int level, istep, num_rows;
+	unsigned int origin;
+	double cost, elapsed;
+	int success;
+	detected_object *objs;
+	double *scores;
+	unsigned int num_objects;
+	unsigned int capacity_objects;
+} cascade_task;
+
 typedef
 struct cascade_st {
 	unsigned int num_stages;
@@ -38,6 +95,7 @@ struct cascade_st {
 	cascade_stage *st, *lst;
 
 	int multi_exit;
+	unsigned int mode;
 	unsigned int width, height;
 	unsigned int step;
 	double scale, min_stddev;
@@ -46,18 +104,51 @@ struct cascade_st {
 	image img;
 	features f;
 
+	int compiled;
+	unsigned int generation, views_generation;
+	compiled_cascade cc;
+	const generated_cascade *generated;
+	const struct cascade_st *model;
+
 	unsigned int min_width, min_height;
 	unsigned int max_width, max_height;
 	unsigned int pyramid_min, pyramid_max;
+	unsigned int min_neighbors;
+	double group_eps;
+	unsigned int dense_depth, skip_windows;
+	double skip_margin;
+	unsigned int coarse_stages;
+	unsigned int strip_height;
+	int pyramid_arena;
 
 	classifier *clfree, *clalloc;
 	cascade_stage *stfree, *stalloc;
 
+	thread_pool *tp;
+	cascade_worker *workers;
+	cascade_level *levels;
+	cascade_task *tasks;
+	cascade_task **schedule;
+	unsigned int num_workers, capacity_levels;
+	unsigned int num_tasks, capacity_tasks;
+	unsigned int next_task;
+
 	detected_object *detected_objects;
 	double *scores;
 	unsigned int num_detected_objects;
 	unsigned int num_jumbled_objects;
 	unsigned int capacity_objects;
+
+	unsigned int *grid_cells, *grid_next;
+	unsigned int capacity_grid_cells, capacity_grid_next;
+	unsigned int *groups;
+	double *group_sums;
+	unsigned int capacity_groups, capacity_group_sums;
+
+	image octaves[CASCADE_MAX_OCTAVES];
+	unsigned int num_octaves;
+	unsigned char *arena;
+	size_t capacity_arena;
 } cascade;
 
 /* Functions */
@@ -72,9 +163,26 @@ void cascade_get_params(const cascade *c, double *scale, double *min_stddev,
 void cascade_set_params(cascade *c, double scale, double min_stddev,
                         unsigned int step, double match_thresh,
                         double overlap_thresh, int multi_exit);
+unsigned int cascade_get_mode(const cascade *c);
+void cascade_set_mode(cascade *c, unsigned int mode);
 void cascade_set_scan(cascade *c,
                       unsigned int min_width, unsigned int min_height,
                       unsigned int max_width, unsigned int max_height);
+void cascade_get_grouping(const cascade *c, unsigned int *min_neighbors,
+                          double *group_eps);
+void cascade_set_grouping(cascade *c, unsigned int min_neighbors,
+                          double group_eps);
+void cascade_get_adaptive(const cascade *c, unsigned int *dense_depth,
+                          double *skip_margin, unsigned int *skip_windows);
+void cascade_set_adaptive(cascade *c, unsigned int dense_depth,
+                          double skip_margin, unsigned int skip_windows);
+unsigned int cascade_get_coarse(const cascade *c);
+void cascade_set_coarse(cascade *c, unsigned int coarse_stages);
+unsigned int cascade_get_strip(const cascade *c);
+void cascade_set_strip(cascade *c, unsigned int strip_height);
+int cascade_get_pyramid(const cascade *c);
+void cascade_set_pyramid(cascade *c, int pyramid_arena);
+void cascade_set_thread_pool(cascade *c, thread_pool *tp);
 
 int cascade_overlap(const cascade *c, const window *w1, const window *w2);
 void cascade_clear(cascade *c);
@@ -82,20 +190,25 @@ void cascade_remove_last_stage(cascade *c);
 void cascade_consolidate_stage(cascade *c, cascade_stage *st);
 
 int cascade_copy(const cascade *from, cascade *to);
+int cascade_share(const cascade *from, cascade *to);
 unsigned int cascade_max_classifiers(const cascade *c, unsigned int parallel);
 
 classifier *cascade_new_classifier(cascade *c, cascade_stage *st,
                                    unsigned int parallel);
 cascade_stage *cascade_new_stage(cascade *c);
+int cascade_compile(cascade *c);
 
 int cascade_set_image(cascade *c, const image *img);
 void cascade_separate(cascade *c, unsigned int offset);
+void cascade_separate_reference(cascade *c, unsigned int offset);
+int cascade_add_object(cascade *c, const window *w, double score);
 int cascade_detect(cascade *c, int separate_detected);
 void cascade_real_window(const cascade *c, const window *comp, window *w);
 int cascade_extract(cascade *c, const window *comp, sval *sat);
 
 int cascade_load(cascade *c, const char *filename, int reset);
 int cascade_save(const cascade *c, const char *filename);
+int cascade_save_binary(const cascade *c, const char *filename);
 
 #endif /* __CASCADE_H */
 
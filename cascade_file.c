@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cascade_file.h"
+#include "utils.h"
+
+#define ALIGN_UP(x) \
+  (((x) + CASCADE_FILE_ALIGN - 1) / CASCADE_FILE_ALIGN * CASCADE_FILE_ALIGN)
+
+static
+int little_endian(void)
+{
+	unsigned int one = 1;
+	return *((unsigned char *) &one) == 1;
+}
+
+/*
+ * FNV-1a over 64-bit words, with a shift to carry the high bits back
+ * down; everything after the checksum field of the header is covered.
+ */
+static
+unsigned long long checksum(const unsigned char *data, size_t size)
+{
+	unsigned long long h, w;
+	size_t i;
+
+	h = 14695981039346656037ULL;
+	for (i = offsetof(cascade_file_header, file_size); i + 8 <= size;
+	     i += 8) {
+		memcpy(&w, &data[i], 8);
+		h ^= w;
+		h *= 1099511628211ULL;
+		h ^= h >> 29;
+	}
+
+	for (; i < size; i++) {
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* Every section keeps the extra element the compiled arrays have */
+static
+void section_sizes(unsigned int num_groups, unsigned int num_classifiers,
+                   unsigned int num_points, unsigned long long *size)
+{
+	unsigned long long ng, nc, np;
+
+	ng = num_groups + 1ULL;
+	nc = num_classifiers + 1ULL;
+	np = num_points + 1ULL;
+
+	size[SECTION_FIRST_CLASSIFIER] = ng * sizeof(unsigned int);
+	size[SECTION_INTERCEPT] = ng * sizeof(double);
+	size[SECTION_FIXED_INTERCEPT] = ng * sizeof(int);
+	size[SECTION_FEATURE_INDEX] = nc * sizeof(feature_index);
+	size[SECTION_COEF] = nc * sizeof(double);
+	size[SECTION_THRESH] = nc * sizeof(double);
+	size[SECTION_REJECT] = nc * sizeof(double);
+	size[SECTION_CELL] = nc * sizeof(feature_cell);
+	size[SECTION_FIRST_POINT] = nc * sizeof(unsigned int);
+	size[SECTION_FIXED_THRESH] = nc * sizeof(int);
+	size[SECTION_FIXED_COEF] = nc * sizeof(int);
+	size[SECTION_FIXED_REJECT] = nc * sizeof(int);
+	size[SECTION_POINT] = np * sizeof(unsigned int);
+	size[SECTION_WEIGHT] = np * sizeof(sval);
+	size[SECTION_CLASSIFIER_INTERCEPT] = nc * sizeof(double);
+}
+
+int cascade_file_is_binary(const char *filename)
+{
+	char magic[8];
+	size_t n;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (!fp) return FALSE;
+
+	n = fread(magic, 1, sizeof(magic), fp);
+	fclose(fp);
+	return (n == sizeof(magic)
+	        && memcmp(magic, CASCADE_FILE_MAGIC, sizeof(magic)) == 0);
+}
+
+static
+int check_header(const cascade_file_header *hdr, const unsigned char *data,
+                 size_t file_size)
+{
+	unsigned long long size[NUM_SECTIONS];
+	unsigned int i;
+
+	if (hdr->version != CASCADE_FILE_VERSION)
+		return FALSE;
+
+	if (hdr->byte_order != CASCADE_FILE_BYTE_ORDER
+	    || hdr->file_size != file_size
+	    || hdr->header_size < sizeof(cascade_file_header)
+	    || hdr->sval_size != sizeof(sval)
+	    || hdr->index_size != sizeof(feature_index)
+	    || hdr->cell_size != sizeof(feature_cell))
+		return FALSE;
+
+	if (hdr->checksum != checksum(data, file_size))
+		return FALSE;
+
+	if (hdr->num_groups != hdr->num_stages * hdr->num_parallels)
+		return FALSE;
+
+	section_sizes(hdr->num_groups, hdr->num_classifiers, hdr->num_points,
+	              size);
+	for (i = 0; i < NUM_SECTIONS; i++) {
+		if (hdr->size[i] != size[i]
+		    || hdr->offset[i] % CASCADE_FILE_ALIGN != 0
+		    || hdr->offset[i] < hdr->header_size
+		    || hdr->offset[i] + size[i] > file_size)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static
+void extent_aux(void *arg, sval weight, unsigned int left, unsigned int top,
+                unsigned int width, unsigned int height)
+{
+	window *extent = (window *) arg;
+	extent->width = MAX(extent->width, left + width);
+	extent->height = MAX(extent->height, top + height);
+}
+
+/*
+ * The checksum only catches corruption, so the ranges are checked too:
+ * the groups and classifiers have to split their arrays in order, and
+ * every feature has to be a known type that fits in the window with as
+ * many points as it compiles to. The point and cell sections are
+ * recomputed for each stride before they are used.
+ */
+static
+int check_indices(const compiled_cascade *cc, const cascade_file_header *hdr)
+{
+	const feature_index *fi;
+	feature_index_opt fo;
+	window extent;
+	unsigned int i;
+
+	if (cc->first_classifier[0] != 0
+	    || cc->first_classifier[cc->num_groups] != cc->num_classifiers)
+		return FALSE;
+
+	for (i = 0; i < cc->num_groups; i++) {
+		if (cc->first_classifier[i] > cc->first_classifier[i + 1])
+			return FALSE;
+	}
+
+	if (cc->first_point[0] != 0
+	    || cc->first_point[cc->num_classifiers] != cc->num_points)
+		return FALSE;
+
+	for (i = 0; i < cc->num_classifiers; i++) {
+		fi = &cc->fi[i];
+		if (fi->idx < 0 || fi->idx >= NUM_HAAR_TYPES
+		    || fi->w.width == 0 || fi->w.height == 0
+		    || fi->w.left >= hdr->width || fi->w.width > hdr->width
+		    || fi->w.top >= hdr->height || fi->w.height > hdr->height)
+			return FALSE;
+
+		extent.width = extent.height = 0;
+		features_emit_rectangle(fi, &extent_aux, &extent);
+		if (extent.width > hdr->width || extent.height > hdr->height)
+			return FALSE;
+
+		if (cc->first_point[i] > cc->first_point[i + 1])
+			return FALSE;
+
+		features_optimize(fi, &fo, 0);
+		if (cc->first_point[i + 1] - cc->first_point[i]
+		    != fo.num_opt_points)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+int cascade_file_map(compiled_cascade *cc, const char *filename,
+                     const cascade_file_header **phdr,
+                     const double **cl_intercept)
+{
+	const cascade_file_header *hdr;
+	unsigned char *data;
+	struct stat st;
+	size_t size;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		error("can't open `%s' for reading", filename);
+		return FALSE;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*hdr)) {
+		error("can't parse `%s'", filename);
+		close(fd);
+		return FALSE;
+	}
+
+	size = (size_t) st.st_size;
+	data = (unsigned char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		error("can't map `%s'", filename);
+		return FALSE;
+	}
+
+	hdr = (const cascade_file_header *) data;
+	if (!check_header(hdr, data, size)) {
+		error("`%s' is not a valid binary cascade for this build",
+		      filename);
+		goto error_map;
+	}
+
+	compiled_cascade_cleanup(cc);
+	compiled_cascade_init(cc);
+	cc->num_stages = hdr->num_stages;
+	cc->num_parallels = hdr->num_parallels;
+	cc->num_groups = hdr->num_groups;
+	cc->num_classifiers = hdr->num_classifiers;
+	cc->num_points = hdr->num_points;
+	cc->thresh_shift = hdr->thresh_shift;
+	cc->coef_shift = hdr->coef_shift;
+	cc->coef_scale = hdr->coef_scale;
+	cc->coef_unit = hdr->coef_unit;
+
+	cc->first_classifier =
+	    (unsigned int *) &data[hdr->offset[SECTION_FIRST_CLASSIFIER]];
+	cc->intercept = (double *) &data[hdr->offset[SECTION_INTERCEPT]];
+	cc->fixed_intercept =
+	    (int *) &data[hdr->offset[SECTION_FIXED_INTERCEPT]];
+	cc->fi = (feature_index *) &data[hdr->offset[SECTION_FEATURE_INDEX]];
+	cc->coef = (double *) &data[hdr->offset[SECTION_COEF]];
+	cc->thresh = (double *) &data[hdr->offset[SECTION_THRESH]];
+	cc->reject = (double *) &data[hdr->offset[SECTION_REJECT]];
+	cc->cell = (feature_cell *) &data[hdr->offset[SECTION_CELL]];
+	cc->first_point =
+	    (unsigned int *) &data[hdr->offset[SECTION_FIRST_POINT]];
+	cc->fixed_thresh = (int *) &data[hdr->offset[SECTION_FIXED_THRESH]];
+	cc->fixed_coef = (int *) &data[hdr->offset[SECTION_FIXED_COEF]];
+	cc->fixed_reject = (int *) &data[hdr->offset[SECTION_FIXED_REJECT]];
+	cc->point = (unsigned int *) &data[hdr->offset[SECTION_POINT]];
+	cc->weight = (sval *) &data[hdr->offset[SECTION_WEIGHT]];
+
+	if (!check_indices(cc, hdr)) {
+		compiled_cascade_init(cc);
+		error("`%s' is not a valid binary cascade for this build",
+		      filename);
+		goto error_map;
+	}
+
+	cc->mapping = data;
+	cc->mapping_size = size;
+	compiled_cascade_reset_cache(cc);
+
+	*phdr = hdr;
+	*cl_intercept = (const double *)
+	    &data[hdr->offset[SECTION_CLASSIFIER_INTERCEPT]];
+	return TRUE;
+
+error_map:
+	munmap(data, size);
+	return FALSE;
+}
+
+int cascade_file_write(const compiled_cascade *cc,
+                       const cascade_file_header *params,
+                       const double *cl_intercept, const char *filename)
+{
+	const void *section[NUM_SECTIONS];
+	size_t used[NUM_SECTIONS];
+	cascade_file_header hdr;
+	unsigned long long offset;
+	unsigned char *data;
+	unsigned int i;
+	size_t size;
+	FILE *fp;
+
+	if (!little_endian()) {
+		error("binary cascades are little-endian only");
+		return FALSE;
+	}
+
+	section[SECTION_FIRST_CLASSIFIER] = cc->first_classifier;
+	section[SECTION_INTERCEPT] = cc->intercept;
+	section[SECTION_FIXED_INTERCEPT] = cc->fixed_intercept;
+	section[SECTION_FEATURE_INDEX] = cc->fi;
+	section[SECTION_COEF] = cc->coef;
+	section[SECTION_THRESH] = cc->thresh;
+	section[SECTION_REJECT] = cc->reject;
+	section[SECTION_CELL] = cc->cell;
+	section[SECTION_FIRST_POINT] = cc->first_point;
+	section[SECTION_FIXED_THRESH] = cc->fixed_thresh;
+	section[SECTION_FIXED_COEF] = cc->fixed_coef;
+	section[SECTION_FIXED_REJECT] = cc->fixed_reject;
+	section[SECTION_POINT] = cc->point;
+	section[SECTION_WEIGHT] = cc->weight;
+	section[SECTION_CLASSIFIER_INTERCEPT] = cl_intercept;
+
+	/* the trailing element is only meaningful for the index arrays */
+	for (i = 0; i < NUM_SECTIONS; i++)
+		used[i] = 0;
+	used[SECTION_FIRST_CLASSIFIER] =
+	    (cc->num_groups + 1) * sizeof(unsigned int);
+	used[SECTION_INTERCEPT] = cc->num_groups * sizeof(double);
+	used[SECTION_FIXED_INTERCEPT] = cc->num_groups * sizeof(int);
+	used[SECTION_FEATURE_INDEX] =
+	    cc->num_classifiers * sizeof(feature_index);
+	used[SECTION_COEF] = cc->num_classifiers * sizeof(double);
+	used[SECTION_THRESH] = cc->num_classifiers * sizeof(double);
+	used[SECTION_REJECT] = cc->num_classifiers * sizeof(double);
+	used[SECTION_CELL] = cc->num_classifiers * sizeof(feature_cell);
+	used[SECTION_FIRST_POINT] =
+	    (cc->num_classifiers + 1) * sizeof(unsigned int);
+	used[SECTION_FIXED_THRESH] = cc->num_classifiers * sizeof(int);
+	used[SECTION_FIXED_COEF] = cc->num_classifiers * sizeof(int);
+	used[SECTION_FIXED_REJECT] = cc->num_classifiers * sizeof(int);
+	used[SECTION_POINT] = cc->num_points * sizeof(unsigned int);
+	used[SECTION_WEIGHT] = cc->num_points * sizeof(sval);
+	used[SECTION_CLASSIFIER_INTERCEPT] =
+	    cc->num_classifiers * sizeof(double);
+
+	hdr = *params;
+	memcpy(hdr.magic, CASCADE_FILE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CASCADE_FILE_VERSION;
+	hdr.byte_order = CASCADE_FILE_BYTE_ORDER;
+	hdr.header_size = (unsigned int)
+	    ALIGN_UP(sizeof(cascade_file_header));
+	hdr.sval_size = sizeof(sval);
+	hdr.index_size = sizeof(feature_index);
+	hdr.cell_size = sizeof(feature_cell);
+	hdr.num_stages = cc->num_stages;
+	hdr.num_parallels = cc->num_parallels;
+	hdr.num_groups = cc->num_groups;
+	hdr.num_classifiers = cc->num_classifiers;
+	hdr.num_points = cc->num_points;
+	hdr.thresh_shift = cc->thresh_shift;
+	hdr.coef_shift = cc->coef_shift;
+	hdr.coef_scale = cc->coef_scale;
+	hdr.coef_unit = cc->coef_unit;
+
+	section_sizes(cc->num_groups, cc->num_classifiers, cc->num_points,
+	              hdr.size);
+	offset = hdr.header_size;
+	for (i = 0; i < NUM_SECTIONS; i++) {
+		hdr.offset[i] = offset;
+		offset = ALIGN_UP(offset + hdr.size[i]);
+	}
+	hdr.file_size = offset;
+
+	size = (size_t) offset;
+	data = (unsigned char *) xmalloc(size);
+	if (!data) return FALSE;
+
+	memset(data, 0, size);
+	for (i = 0; i < NUM_SECTIONS; i++) {
+		if (used[i])
+			memcpy(&data[hdr.offset[i]], section[i], used[i]);
+	}
+	memcpy(data, &hdr, sizeof(cascade_file_header));
+	((cascade_file_header *) data)->checksum = checksum(data, size);
+
+	fp = fopen(filename, "wb");
+	if (!fp) {
+		error("can't open `%s' for writing", filename);
+		free(data);
+		return FALSE;
+	}
+
+	if (fwrite(data, 1, size, fp) != size) {
+		error("can't write `%s'", filename);
+		fclose(fp);
+		free(data);
+		return FALSE;
+	}
+
+	fclose(fp);
+	free(data);
+	return TRUE;
+}
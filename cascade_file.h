@@ -0,0 +1,72 @@
+
+#ifndef __CASCADE_FILE_H
+#define __CASCADE_FILE_H
+
+#include "compiled_cascade.h"
+
+/*
+ * Binary cascades hold the compiled arrays as they are laid out in
+ * memory, so that a file can be mapped and evaluated without parsing.
+ * Every section starts at a multiple of CASCADE_FILE_ALIGN bytes and
+ * the file is checksummed from the field after the checksum onwards.
+ */
+#define CASCADE_FILE_MAGIC       "HAARCASC"
+#define CASCADE_FILE_VERSION     1
+#define CASCADE_FILE_BYTE_ORDER  0x01020304U
+#define CASCADE_FILE_ALIGN       64
+
+/* Data structures and types */
+enum cascade_file_section {
+	SECTION_FIRST_CLASSIFIER = 0,
+	SECTION_INTERCEPT,
+	SECTION_FIXED_INTERCEPT,
+	SECTION_FEATURE_INDEX,
+	SECTION_COEF,
+	SECTION_THRESH,
+	SECTION_REJECT,
+	SECTION_CELL,
+	SECTION_FIRST_POINT,
+	SECTION_FIXED_THRESH,
+	SECTION_FIXED_COEF,
+	SECTION_FIXED_REJECT,
+	SECTION_POINT,
+	SECTION_WEIGHT,
+	SECTION_CLASSIFIER_INTERCEPT,
+	NUM_SECTIONS
+};
+
+typedef
+struct cascade_file_header_st {
+	char magic[8];
+	unsigned int version, byte_order;
+	unsigned long long checksum;
+	unsigned long long file_size;
+	unsigned int header_size, sval_size;
+	unsigned int index_size, cell_size;
+
+	unsigned int width, height;
+	unsigned int num_parallels, num_stages;
+	unsigned int step;
+	int multi_exit;
+	double scale, min_stddev;
+	double match_thresh, overlap_thresh;
+
+	unsigned int num_groups, num_classifiers, num_points;
+	int thresh_shift, coef_shift;
+	unsigned int reserved;
+	double coef_scale, coef_unit;
+
+	unsigned long long offset[NUM_SECTIONS];
+	unsigned long long size[NUM_SECTIONS];
+} cascade_file_header;
+
+/* Functions */
+int cascade_file_is_binary(const char *filename);
+int cascade_file_map(compiled_cascade *cc, const char *filename,
+                     const cascade_file_header **phdr,
+                     const double **cl_intercept);
+int cascade_file_write(const compiled_cascade *cc,
+                       const cascade_file_header *params,
+                       const double *cl_intercept, const char *filename);
+
+#endif /* __CASCADE_FILE_H */
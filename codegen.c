@@ -0,0 +1,177 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "codegen.h"
+#include "compiled_cascade.h"
+#include "features.h"
+#include "utils.h"
+
+/* Wide enough to split the optimized points back into columns and rows */
+#define CODEGEN_STRIDE    65536
+#define CODEGEN_TERMS         4
+
+static
+void write_feature(FILE *fp, const feature_index *fi)
+{
+	feature_index_opt fo;
+	unsigned int point[MAX_OPT_POINTS];
+	int weight[MAX_OPT_POINTS];
+	unsigned int i, j, n, x, y;
+
+	features_optimize(fi, &fo, CODEGEN_STRIDE);
+
+	n = 0;
+	for (i = 0; i < fo.num_opt_points; i++) {
+		for (j = 0; j < n; j++) {
+			if (point[j] == fo.point[i]) break;
+		}
+		if (j == n) {
+			point[n] = fo.point[i];
+			weight[n++] = 0;
+		}
+		weight[j] += (int) fo.weight[i];
+	}
+
+	fprintf(fp, "\tt = ");
+	for (i = 0, j = 0; i < n; i++) {
+		if (weight[i] == 0) continue;
+
+		if (j > 0 && j % CODEGEN_TERMS == 0)
+			fprintf(fp, "\n\t    ");
+		if (j > 0)
+			fprintf(fp, (weight[i] < 0) ? " - " : " + ");
+		else if (weight[i] < 0)
+			fprintf(fp, "-");
+		if (abs(weight[i]) != 1)
+			fprintf(fp, "%d * ", abs(weight[i]));
+
+		x = point[i] % CODEGEN_STRIDE;
+		y = point[i] / CODEGEN_STRIDE;
+		if (y == 0)
+			fprintf(fp, "sat[%u]", x);
+		else if (y == 1)
+			fprintf(fp, "sat[stride + %u]", x);
+		else
+			fprintf(fp, "sat[%u * stride + %u]", y, x);
+		j++;
+	}
+	if (j == 0)
+		fprintf(fp, "0");
+	fprintf(fp, ";\n");
+}
+
+static
+void write_group(FILE *fp, const compiled_cascade *cc, unsigned int g)
+{
+	unsigned int i;
+
+	fprintf(fp, "static inline\n"
+	        "double group_%u(const sval *sat, unsigned int stride, "
+	        "double factor,\n"
+	        "               double val)\n"
+	        "{\n"
+	        "\tsval t;\n\n", g);
+
+	for (i = cc->first_classifier[g]; i < cc->first_classifier[g + 1];
+	     i++) {
+		write_feature(fp, &cc->fi[i]);
+		fprintf(fp, "\tif (((double) t) >= factor * %.17g)\n"
+		        "\t\tval += %.17g;\n", cc->thresh[i], cc->coef[i]);
+		if (cc->reject[i] == -HUGE_VAL) continue;
+
+		fprintf(fp, "\tif (val < %.17g)\n", cc->reject[i]);
+		if (cc->num_parallels == 1)
+			fprintf(fp, "\t\treturn -HUGE_VAL;\n");
+		else
+			fprintf(fp, "\t\treturn val < -DBL_MIN ? val "
+			        ": -DBL_MIN;\n");
+	}
+	fprintf(fp, "\treturn val;\n}\n\n");
+}
+
+static
+void write_evaluate(FILE *fp, const compiled_cascade *cc)
+{
+	unsigned int g, k, stage;
+
+	fprintf(fp, "static\n"
+	        "double evaluate(const sval *sat, unsigned int stride, "
+	        "double factor,\n"
+	        "                int multi_exit, double *score, "
+	        "unsigned int *sel)\n"
+	        "{\n");
+
+	if (cc->num_parallels == 1) {
+		fprintf(fp, "\tdouble val;\n\n"
+		        "\t(void) sel;\n"
+		        "\tval = score[0];\n");
+		for (g = 0; g < cc->num_groups; g++) {
+			fprintf(fp, "\tval = group_%u(sat, stride, factor, "
+			        "multi_exit ? val + %.17g\n"
+			        "\t                                     : %.17g);\n"
+			        "\tif (val < 0)\n"
+			        "\t\treturn val;\n", g, cc->intercept[g],
+			        cc->intercept[g]);
+		}
+		fprintf(fp, "\tscore[0] = val;\n"
+		        "\treturn val;\n}\n\n");
+		return;
+	}
+
+	fprintf(fp, "\tunsigned int best;\n\n");
+	g = 0;
+	for (stage = 0; stage < cc->num_stages; stage++) {
+		for (k = 0; k < cc->num_parallels; k++, g++) {
+			fprintf(fp, "\tscore[%u] = group_%u(sat, stride, factor, "
+			        "multi_exit ? score[%u] + %.17g\n"
+			        "\t                                     : %.17g);\n",
+			        k, g, k, cc->intercept[g], cc->intercept[g]);
+		}
+		fprintf(fp, "\tbest = generated_best(score, %u);\n"
+		        "\t*sel = best;\n"
+		        "\tif (score[best] < 0)\n"
+		        "\t\treturn score[best];\n", cc->num_parallels);
+	}
+	fprintf(fp, "\treturn score[*sel];\n}\n\n");
+}
+
+int codegen_save(const compiled_cascade *cc, const char *filename,
+                 const char *name, const char *source)
+{
+	unsigned int g;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (!fp) {
+		error("can't open `%s' for writing", filename);
+		return FALSE;
+	}
+
+	fprintf(fp, "/*\n"
+	        " * Cascade `%s' compiled by \"haarcascade compile\"; "
+	        "do not edit.\n"
+	        " * Link it in with \"make MODELS=%s\" and detect with "
+	        "--generated.\n"
+	        " */\n\n"
+	        "#include <float.h>\n"
+	        "#include <math.h>\n\n"
+	        "#include \"generated.h\"\n\n", source, filename);
+
+	for (g = 0; g < cc->num_groups; g++)
+		write_group(fp, cc, g);
+	write_evaluate(fp, cc);
+
+	fprintf(fp, "static generated_cascade cascade_info = {\n"
+	        "\t\"%s\", 0x%016llxULL, &evaluate, NULL\n"
+	        "};\n\n"
+	        "static void __attribute__((constructor))\n"
+	        "register_cascade(void)\n"
+	        "{\n"
+	        "\tgenerated_register(&cascade_info);\n"
+	        "}\n", name, compiled_cascade_fingerprint(cc));
+
+	fclose(fp);
+	return TRUE;
+}
@@ -0,0 +1,11 @@
+
+#ifndef __CODEGEN_H
+#define __CODEGEN_H
+
+#include "compiled_cascade.h"
+
+/* Functions */
+int codegen_save(const compiled_cascade *cc, const char *filename,
+                 const char *name, const char *source);
+
+#endif /* __CODEGEN_H */
@@ -0,0 +1,747 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "compiled_cascade.h"
+#include "features.h"
+#include "cpu.h"
+#include "utils.h"
+
+void compiled_cascade_reset(compiled_cascade *cc)
+{
+	cc->first_classifier = NULL;
+	cc->intercept = NULL;
+	cc->fi = NULL;
+	cc->thresh = NULL;
+	cc->coef = NULL;
+	cc->reject = NULL;
+	cc->cell = NULL;
+	cc->first_point = NULL;
+	cc->fixed_intercept = NULL;
+	cc->fixed_thresh = NULL;
+	cc->fixed_coef = NULL;
+	cc->fixed_reject = NULL;
+	cc->point = NULL;
+	cc->weight = NULL;
+	cc->own_point = NULL;
+	cc->own_cell = NULL;
+	cc->shared = FALSE;
+	cc->model = NULL;
+	cc->mapping = NULL;
+	cc->cache = NULL;
+	cc->generated = NULL;
+}
+
+void compiled_cascade_init(compiled_cascade *cc)
+{
+	compiled_cascade_reset(cc);
+	cc->num_stages = 0;
+	cc->num_parallels = 0;
+	cc->num_groups = 0;
+	cc->num_classifiers = 0;
+	cc->num_points = 0;
+	cc->capacity_groups = 0;
+	cc->capacity_classifiers = 0;
+	cc->capacity_points = 0;
+	cc->stride = 0;
+	cc->width = 0;
+	cc->height = 0;
+	cc->scale = 1;
+	cc->fixed = FALSE;
+	cc->thresh_shift = -1;
+	cc->coef_shift = -1;
+	cc->coef_scale = 1;
+	cc->coef_unit = 1;
+}
+
+static
+void compiled_cascade_free_groups(compiled_cascade *cc)
+{
+	if (cc->first_classifier) {
+		free(cc->first_classifier);
+		cc->first_classifier = NULL;
+	}
+
+	if (cc->intercept) {
+		free(cc->intercept);
+		cc->intercept = NULL;
+	}
+
+	if (cc->fixed_intercept) {
+		free(cc->fixed_intercept);
+		cc->fixed_intercept = NULL;
+	}
+	cc->capacity_groups = 0;
+}
+
+static
+void compiled_cascade_free_classifiers(compiled_cascade *cc)
+{
+	if (cc->fi) {
+		free(cc->fi);
+		cc->fi = NULL;
+	}
+
+	if (cc->thresh) {
+		free(cc->thresh);
+		cc->thresh = NULL;
+	}
+
+	if (cc->coef) {
+		free(cc->coef);
+		cc->coef = NULL;
+	}
+
+	if (cc->reject) {
+		free(cc->reject);
+		cc->reject = NULL;
+	}
+
+	if (cc->cell) {
+		free(cc->cell);
+		cc->cell = NULL;
+	}
+
+	if (cc->first_point) {
+		free(cc->first_point);
+		cc->first_point = NULL;
+	}
+
+	if (cc->fixed_thresh) {
+		free(cc->fixed_thresh);
+		cc->fixed_thresh = NULL;
+	}
+
+	if (cc->fixed_coef) {
+		free(cc->fixed_coef);
+		cc->fixed_coef = NULL;
+	}
+
+	if (cc->fixed_reject) {
+		free(cc->fixed_reject);
+		cc->fixed_reject = NULL;
+	}
+	cc->capacity_classifiers = 0;
+}
+
+static
+void compiled_cascade_free_points(compiled_cascade *cc)
+{
+	if (cc->point) {
+		free(cc->point);
+		cc->point = NULL;
+	}
+
+	if (cc->weight) {
+		free(cc->weight);
+		cc->weight = NULL;
+	}
+	cc->capacity_points = 0;
+}
+
+static
+void compiled_cascade_free_cache(compiled_cascade *cc)
+{
+	compiled_stride *cs;
+
+	if (!cc->cache) return;
+
+	while (cc->cache->first) {
+		cs = cc->cache->first;
+		cc->cache->first = cs->next;
+		free(cs->point);
+		free(cs->cell);
+		free(cs);
+	}
+	pthread_mutex_destroy(&cc->cache->mtx);
+	free(cc->cache);
+	cc->cache = NULL;
+}
+
+void compiled_cascade_cleanup(compiled_cascade *cc)
+{
+	if (cc->shared) {
+		if (cc->own_point) free(cc->own_point);
+		if (cc->own_cell) free(cc->own_cell);
+		if (cc->thresh) free(cc->thresh);
+		if (cc->fixed_thresh) free(cc->fixed_thresh);
+		compiled_cascade_init(cc);
+		return;
+	}
+
+	compiled_cascade_free_cache(cc);
+
+	/* the arrays of a mapped binary cascade all live in the mapping */
+	if (cc->mapping) {
+		munmap(cc->mapping, cc->mapping_size);
+		compiled_cascade_init(cc);
+		return;
+	}
+
+	compiled_cascade_free_groups(cc);
+	compiled_cascade_free_classifiers(cc);
+	compiled_cascade_free_points(cc);
+}
+
+int compiled_cascade_allocate(compiled_cascade *cc, unsigned int num_stages,
+                              unsigned int num_parallels,
+                              unsigned int num_classifiers)
+{
+	unsigned int num_groups, num_points;
+	size_t size;
+
+	if (cc->shared || cc->mapping)
+		compiled_cascade_cleanup(cc);
+
+	num_groups = num_stages * num_parallels;
+	if (cc->capacity_groups < num_groups + 1) {
+		compiled_cascade_free_groups(cc);
+
+		size = (num_groups + 1) * sizeof(unsigned int);
+		cc->first_classifier = (unsigned int *) xmalloc(size);
+		if (!cc->first_classifier) goto error_allocate;
+
+		size = (num_groups + 1) * sizeof(double);
+		cc->intercept = (double *) xmalloc(size);
+		if (!cc->intercept) goto error_allocate;
+
+		size = (num_groups + 1) * sizeof(int);
+		cc->fixed_intercept = (int *) xmalloc(size);
+		if (!cc->fixed_intercept) goto error_allocate;
+
+		cc->capacity_groups = num_groups + 1;
+	}
+
+	if (cc->capacity_classifiers < num_classifiers + 1) {
+		compiled_cascade_free_classifiers(cc);
+
+		size = (num_classifiers + 1) * sizeof(feature_index);
+		cc->fi = (feature_index *) xmalloc(size);
+		if (!cc->fi) goto error_allocate;
+
+		size = (num_classifiers + 1) * sizeof(double);
+		cc->thresh = (double *) xmalloc(size);
+		if (!cc->thresh) goto error_allocate;
+
+		cc->coef = (double *) xmalloc(size);
+		if (!cc->coef) goto error_allocate;
+
+		cc->reject = (double *) xmalloc(size);
+		if (!cc->reject) goto error_allocate;
+
+		size = (num_classifiers + 1) * sizeof(feature_cell);
+		cc->cell = (feature_cell *) xmalloc(size);
+		if (!cc->cell) goto error_allocate;
+
+		size = (num_classifiers + 1) * sizeof(unsigned int);
+		cc->first_point = (unsigned int *) xmalloc(size);
+		if (!cc->first_point) goto error_allocate;
+
+		size = (num_classifiers + 1) * sizeof(int);
+		cc->fixed_thresh = (int *) xmalloc(size);
+		if (!cc->fixed_thresh) goto error_allocate;
+
+		cc->fixed_coef = (int *) xmalloc(size);
+		if (!cc->fixed_coef) goto error_allocate;
+
+		cc->fixed_reject = (int *) xmalloc(size);
+		if (!cc->fixed_reject) goto error_allocate;
+
+		cc->capacity_classifiers = num_classifiers + 1;
+	}
+
+	num_points = num_classifiers * MAX_OPT_POINTS;
+	if (cc->capacity_points < num_points + 1) {
+		compiled_cascade_free_points(cc);
+
+		size = (num_points + 1) * sizeof(unsigned int);
+		cc->point = (unsigned int *) xmalloc(size);
+		if (!cc->point) goto error_allocate;
+
+		size = (num_points + 1) * sizeof(sval);
+		cc->weight = (sval *) xmalloc(size);
+		if (!cc->weight) goto error_allocate;
+
+		cc->capacity_points = num_points + 1;
+	}
+
+	cc->num_stages = num_stages;
+	cc->num_parallels = num_parallels;
+	cc->num_groups = 0;
+	cc->num_classifiers = 0;
+	cc->num_points = 0;
+	cc->stride = 0;
+	cc->first_classifier[0] = 0;
+	cc->first_point[0] = 0;
+	return TRUE;
+
+error_allocate:
+	compiled_cascade_cleanup(cc);
+	return FALSE;
+}
+
+void compiled_cascade_add_group(compiled_cascade *cc, double intercept)
+{
+	cc->intercept[cc->num_groups] = intercept;
+	cc->first_classifier[cc->num_groups] = cc->num_classifiers;
+	cc->num_groups++;
+}
+
+void compiled_cascade_add(compiled_cascade *cc, const feature_index *fi,
+                          double coef, double thresh, double reject)
+{
+	feature_index_opt fo;
+	unsigned int i, j;
+
+	features_optimize(fi, &fo, 0);
+
+	i = cc->num_classifiers++;
+	cc->fi[i] = *fi;
+	cc->coef[i] = coef;
+	cc->thresh[i] = thresh;
+	cc->reject[i] = reject;
+	cc->cell[i] = fo.cell;
+
+	for (j = 0; j < fo.num_opt_points; j++) {
+		cc->point[cc->num_points] = fo.point[j];
+		cc->weight[cc->num_points] = fo.weight[j];
+		cc->num_points++;
+	}
+	cc->first_point[cc->num_classifiers] = cc->num_points;
+}
+
+/*
+ * Picks the largest power of two that keeps every scaled threshold
+ * within FIXED_MAX_THRESH, or marks the thresholds as out of range.
+ */
+static
+void fixed_thresholds(compiled_cascade *cc)
+{
+	unsigned int i;
+	double max_thresh;
+	int shift;
+
+	max_thresh = 0;
+	for (i = 0; i < cc->num_classifiers; i++)
+		max_thresh = MAX(max_thresh, fabs(cc->thresh[i]));
+
+	shift = FIXED_MAX_SHIFT;
+	while (shift >= -FIXED_FACTOR_BITS
+	       && ldexp(max_thresh, shift) > FIXED_MAX_THRESH)
+		shift--;
+
+	if (shift < -FIXED_FACTOR_BITS) {
+		cc->thresh_shift = -1;
+		return;
+	}
+
+	for (i = 0; i < cc->num_classifiers; i++) {
+		cc->fixed_thresh[i] = (int) floor(0.5 + ldexp(cc->thresh[i],
+		                                              shift));
+	}
+	cc->thresh_shift = shift + FIXED_FACTOR_BITS;
+}
+
+static
+int fixed_sum(double val, int shift, int round_up)
+{
+	val = ldexp(val, shift);
+	val = round_up ? ceil(val) : floor(0.5 + val);
+	val = MAX(-FIXED_MAX_SUM, MIN(FIXED_MAX_SUM, val));
+	return (int) val;
+}
+
+static
+void fixed_sums(compiled_cascade *cc)
+{
+	unsigned int i;
+	double bound;
+	int shift;
+
+	bound = 0;
+	for (i = 0; i < cc->num_groups; i++)
+		bound += fabs(cc->intercept[i]);
+	for (i = 0; i < cc->num_classifiers; i++)
+		bound += fabs(cc->coef[i]);
+
+	shift = FIXED_MAX_SHIFT;
+	while (shift >= 0 && ldexp(bound, shift) >= FIXED_MAX_SUM / 2)
+		shift--;
+
+	cc->coef_shift = shift;
+	if (shift < 0) return;
+
+	cc->coef_scale = ldexp(1, shift);
+	cc->coef_unit = ldexp(1, -shift);
+
+	for (i = 0; i < cc->num_groups; i++)
+		cc->fixed_intercept[i] = fixed_sum(cc->intercept[i], shift, FALSE);
+
+	for (i = 0; i < cc->num_classifiers; i++) {
+		cc->fixed_coef[i] = fixed_sum(cc->coef[i], shift, FALSE);
+		if (cc->reject[i] == -HUGE_VAL)
+			cc->fixed_reject[i] = INT_MIN;
+		else
+			cc->fixed_reject[i] = fixed_sum(cc->reject[i], shift,
+			                                TRUE);
+	}
+}
+
+void compiled_cascade_finish(compiled_cascade *cc)
+{
+	cc->first_classifier[cc->num_groups] = cc->num_classifiers;
+	cc->first_point[cc->num_classifiers] = cc->num_points;
+	cc->stride = 0;
+	fixed_sums(cc);
+	fixed_thresholds(cc);
+	compiled_cascade_reset_cache(cc);
+}
+
+/*
+ * Drops the offsets computed for the previous arrays of the model;
+ * without a cache every worker computes its own offsets.
+ */
+void compiled_cascade_reset_cache(compiled_cascade *cc)
+{
+	compiled_cascade_free_cache(cc);
+
+	cc->cache = (compiled_cache *) xmalloc(sizeof(compiled_cache));
+	if (!cc->cache) return;
+
+	if (pthread_mutex_init(&cc->cache->mtx, NULL) != 0) {
+		free(cc->cache);
+		cc->cache = NULL;
+		return;
+	}
+	cc->cache->first = NULL;
+	cc->cache->size = 0;
+}
+
+int compiled_cascade_share(const compiled_cascade *from, compiled_cascade *to)
+{
+	int *fixed_thresh;
+	double *thresh;
+	size_t size;
+
+	size = (from->num_classifiers + 1) * sizeof(double);
+	thresh = (double *) xmalloc(size);
+	if (!thresh) return FALSE;
+	memcpy(thresh, from->thresh, size);
+
+	size = (from->num_classifiers + 1) * sizeof(int);
+	fixed_thresh = (int *) xmalloc(size);
+	if (!fixed_thresh) {
+		free(thresh);
+		return FALSE;
+	}
+	memcpy(fixed_thresh, from->fixed_thresh, size);
+
+	compiled_cascade_cleanup(to);
+	*to = *from;
+	to->capacity_groups = 0;
+	to->capacity_classifiers = from->num_classifiers + 1;
+	to->capacity_points = 0;
+	to->thresh = thresh;
+	to->fixed_thresh = fixed_thresh;
+	to->own_point = NULL;
+	to->own_cell = NULL;
+	to->shared = TRUE;
+	to->model = from;
+	to->mapping = NULL;
+	to->cache = NULL;
+	return TRUE;
+}
+
+void compiled_cascade_set_fixed(compiled_cascade *cc, int fixed)
+{
+	cc->fixed = fixed;
+}
+
+static
+unsigned long long fingerprint_add(unsigned long long h, const void *data,
+                                   size_t size)
+{
+	const unsigned char *p;
+	size_t i;
+
+	p = (const unsigned char *) data;
+	for (i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+ * FNV-1a hash of everything a generated evaluator bakes in, used to
+ * match a loaded cascade with one compiled into the program.
+ */
+unsigned long long compiled_cascade_fingerprint(const compiled_cascade *cc)
+{
+	unsigned long long h;
+	unsigned int g, i;
+	const feature_index *fi;
+
+	h = 14695981039346656037ULL;
+	h = fingerprint_add(h, &cc->num_stages, sizeof(unsigned int));
+	h = fingerprint_add(h, &cc->num_parallels, sizeof(unsigned int));
+	for (g = 0; g < cc->num_groups; g++) {
+		h = fingerprint_add(h, &cc->first_classifier[g + 1],
+		                    sizeof(unsigned int));
+		h = fingerprint_add(h, &cc->intercept[g], sizeof(double));
+	}
+
+	for (i = 0; i < cc->num_classifiers; i++) {
+		fi = &cc->fi[i];
+		h = fingerprint_add(h, &fi->idx, sizeof(int));
+		h = fingerprint_add(h, &fi->w.left, sizeof(unsigned int));
+		h = fingerprint_add(h, &fi->w.top, sizeof(unsigned int));
+		h = fingerprint_add(h, &fi->w.width, sizeof(unsigned int));
+		h = fingerprint_add(h, &fi->w.height, sizeof(unsigned int));
+		h = fingerprint_add(h, &cc->coef[i], sizeof(double));
+		h = fingerprint_add(h, &cc->thresh[i], sizeof(double));
+		h = fingerprint_add(h, &cc->reject[i], sizeof(double));
+	}
+	return h;
+}
+
+void compiled_cascade_set_generated(compiled_cascade *cc,
+                                    const generated_cascade *gc)
+{
+	cc->generated = gc;
+}
+
+static
+void precomp_offsets(const compiled_cascade *cc, unsigned int stride,
+                     unsigned int *point, feature_cell *cell)
+{
+	feature_index_opt fo;
+	unsigned int i, j, pos;
+
+	for (i = 0; i < cc->num_classifiers; i++) {
+		features_optimize(&cc->fi[i], &fo, stride);
+		pos = cc->first_point[i];
+		for (j = 0; j < fo.num_opt_points; j++)
+			point[pos + j] = fo.point[j];
+		cell[i] = fo.cell;
+	}
+	point[cc->num_points] = 0;
+}
+
+static
+compiled_stride *find_stride(compiled_cache *cache, unsigned int stride)
+{
+	compiled_stride *cs;
+
+	for (cs = cache->first; cs; cs = cs->next) {
+		if (cs->stride == stride)
+			return cs;
+	}
+	return NULL;
+}
+
+/*
+ * Looks the offsets for a stride up in the model's cache, computing
+ * and adding them on a miss; the computation runs outside the lock
+ * and loses to any worker that added the same stride meanwhile.
+ */
+static
+const compiled_stride *cached_stride(const compiled_cascade *model,
+                                     unsigned int stride)
+{
+	compiled_cache *cache = model->cache;
+	compiled_stride *cs, *found;
+	size_t size;
+	int full;
+
+	if (!cache) return NULL;
+
+	size = (model->num_points + 1) * sizeof(unsigned int)
+	       + (model->num_classifiers + 1) * sizeof(feature_cell);
+
+	pthread_mutex_lock(&cache->mtx);
+	found = find_stride(cache, stride);
+	full = (cache->size + size > COMPILED_CACHE_SIZE);
+	pthread_mutex_unlock(&cache->mtx);
+	if (found || full) return found;
+
+	cs = (compiled_stride *) xmalloc(sizeof(compiled_stride));
+	if (!cs) return NULL;
+
+	cs->point = (unsigned int *)
+	    xmalloc((model->num_points + 1) * sizeof(unsigned int));
+	cs->cell = (feature_cell *)
+	    xmalloc((model->num_classifiers + 1) * sizeof(feature_cell));
+	if (!cs->point || !cs->cell) {
+		if (cs->point) free(cs->point);
+		if (cs->cell) free(cs->cell);
+		free(cs);
+		return NULL;
+	}
+
+	cs->stride = stride;
+	precomp_offsets(model, stride, cs->point, cs->cell);
+
+	pthread_mutex_lock(&cache->mtx);
+	found = find_stride(cache, stride);
+	if (!found && cache->size + size <= COMPILED_CACHE_SIZE) {
+		cs->next = cache->first;
+		cache->first = cs;
+		cache->size += size;
+		found = cs;
+		cs = NULL;
+	}
+	pthread_mutex_unlock(&cache->mtx);
+
+	if (cs) {
+		free(cs->point);
+		free(cs->cell);
+		free(cs);
+	}
+	return found;
+}
+
+/* Arrays of a worker's own, for offsets the cache does not hold */
+static
+int own_offsets(compiled_cascade *cc)
+{
+	if (!cc->shared)
+		return TRUE;
+
+	if (!cc->own_point) {
+		cc->own_point = (unsigned int *)
+		    xmalloc((cc->num_points + 1) * sizeof(unsigned int));
+		if (!cc->own_point) return FALSE;
+	}
+
+	if (!cc->own_cell) {
+		cc->own_cell = (feature_cell *)
+		    xmalloc((cc->num_classifiers + 1) * sizeof(feature_cell));
+		if (!cc->own_cell) return FALSE;
+	}
+
+	cc->point = cc->own_point;
+	cc->cell = cc->own_cell;
+	return TRUE;
+}
+
+int compiled_cascade_precomp(compiled_cascade *cc, unsigned int stride)
+{
+	const compiled_stride *cs;
+
+	if (cc->stride == stride && cc->scale == 1)
+		return TRUE;
+
+	cs = (cc->model) ? cached_stride(cc->model, stride) : NULL;
+	if (cs) {
+		cc->point = cs->point;
+		cc->cell = cs->cell;
+	} else {
+		if (!own_offsets(cc))
+			return FALSE;
+		precomp_offsets(cc, stride, cc->point, cc->cell);
+	}
+
+	if (cc->scale != 1) {
+		memcpy(cc->thresh, cc->model->thresh,
+		       cc->num_classifiers * sizeof(double));
+		memcpy(cc->fixed_thresh, cc->model->fixed_thresh,
+		       cc->num_classifiers * sizeof(int));
+		cc->thresh_shift = cc->model->thresh_shift;
+		cc->scale = 1;
+	}
+	cc->stride = stride;
+	return TRUE;
+}
+
+int compiled_cascade_precomp_scaled(compiled_cascade *cc, unsigned int stride,
+                                    double scale, unsigned int width,
+                                    unsigned int height)
+{
+	feature_index_opt fo;
+	feature_index sfi;
+	unsigned int i, j, pos;
+	double ratio;
+
+	if (!cc->model) {
+		error("only shared cascades can be scaled");
+		return FALSE;
+	}
+
+	if (cc->stride == stride && cc->scale == scale
+	    && cc->width == width && cc->height == height)
+		return TRUE;
+
+	if (!own_offsets(cc))
+		return FALSE;
+
+	for (i = 0; i < cc->num_classifiers; i++) {
+		ratio = features_scale(&cc->fi[i], &sfi, scale, width, height);
+		features_optimize(&sfi, &fo, stride);
+		pos = cc->first_point[i];
+		for (j = 0; j < fo.num_opt_points; j++)
+			cc->point[pos + j] = fo.point[j];
+		cc->cell[i] = fo.cell;
+
+		cc->thresh[i] = cc->model->thresh[i] * ratio;
+	}
+	fixed_thresholds(cc);
+
+	cc->stride = stride;
+	cc->scale = scale;
+	cc->width = width;
+	cc->height = height;
+	return TRUE;
+}
+
+/* Generated evaluators don't report the stage a window is rejected at,
+ * so the kernels are used when depth is asked for */
+double compiled_cascade_evaluate(const compiled_cascade *cc, const sval *sat,
+                                 double factor, int multi_exit,
+                                 double *score, unsigned int *sel,
+                                 unsigned int *depth)
+{
+	unsigned int k;
+
+	for (k = 0; k < cc->num_parallels; k++)
+		score[k] = 0;
+
+	*sel = 0;
+	if (cc->generated && cc->scale == 1 && !depth) {
+		return cc->generated->evaluate(sat, cc->stride, factor,
+		                               multi_exit, score, sel);
+	}
+	return cpu_kernels()->evaluate(cc, sat, factor, multi_exit, 0,
+	                               score, sel, depth);
+}
+
+unsigned int compiled_cascade_evaluate_lanes(const compiled_cascade *cc,
+                                             const sval *sat,
+                                             unsigned int step,
+                                             unsigned int num_lanes,
+                                             unsigned int mask,
+                                             const double *factor,
+                                             int multi_exit, double *val,
+                                             double *score, unsigned int *sel)
+{
+	return cpu_kernels()->evaluate_lanes(cc, sat, step, num_lanes, mask,
+	                                     factor, multi_exit, val,
+	                                     score, sel);
+}
+
+unsigned int compiled_cascade_evaluate_batch(const compiled_cascade *cc,
+                                             const sval *sat, int multi_exit,
+                                             unsigned int stage,
+                                             unsigned int count,
+                                             unsigned int *offset,
+                                             double *factor,
+                                             unsigned int *index,
+                                             double *score, unsigned int *sel)
+{
+	return cpu_kernels()->evaluate_batch(cc, sat, multi_exit, stage, count,
+	                                     offset, factor, index, score, sel);
+}
@@ -0,0 +1,125 @@
+
+#ifndef __COMPILED_CASCADE_H
+#define __COMPILED_CASCADE_H
+
+#include <pthread.h>
+
+#include "features.h"
+#include "generated.h"
+
+#define COMPILED_LANES           16
+
+/* Bytes of per-stride offsets a model keeps for its workers */
+#define COMPILED_CACHE_SIZE      (64 * 1024 * 1024)
+
+/*
+ * Fixed-point evaluation: the window factor carries FIXED_FACTOR_BITS
+ * fractional bits and the thresholds are scaled so that their product
+ * fits in 32 bits; stage sums are kept below FIXED_MAX_SUM.
+ */
+#define FIXED_FACTOR_BITS        8
+#define FIXED_MAX_FACTOR         32767
+#define FIXED_MAX_THRESH         65535
+#define FIXED_MAX_SHIFT          16
+#define FIXED_MAX_SUM            1073741824.0
+
+/* Data structures */
+typedef
+struct compiled_stride_st {
+	struct compiled_stride_st *next;
+	unsigned int stride;
+	unsigned int *point;
+	feature_cell *cell;
+} compiled_stride;
+
+typedef
+struct compiled_cache_st {
+	pthread_mutex_t mtx;
+	compiled_stride *first;
+	size_t size;
+} compiled_cache;
+
+typedef
+struct compiled_cascade_st {
+	unsigned int num_stages, num_parallels;
+	unsigned int num_groups, num_classifiers, num_points;
+	unsigned int capacity_groups, capacity_classifiers;
+	unsigned int capacity_points;
+	unsigned int stride;
+	unsigned int width, height;
+	double scale;
+	int shared;
+	const struct compiled_cascade_st *model;
+	void *mapping;
+	size_t mapping_size;
+	compiled_cache *cache;
+
+	unsigned int *first_classifier;
+	double *intercept;
+
+	feature_index *fi;
+	double *thresh, *coef, *reject;
+	feature_cell *cell;
+	unsigned int *first_point;
+
+	int fixed;
+	int thresh_shift, coef_shift;
+	double coef_scale, coef_unit;
+	int *fixed_intercept;
+	int *fixed_thresh, *fixed_coef, *fixed_reject;
+
+	const generated_cascade *generated;
+
+	unsigned int *point;
+	sval *weight;
+
+	unsigned int *own_point;
+	feature_cell *own_cell;
+} compiled_cascade;
+
+/* Functions */
+void compiled_cascade_reset(compiled_cascade *cc);
+void compiled_cascade_init(compiled_cascade *cc);
+void compiled_cascade_cleanup(compiled_cascade *cc);
+
+int compiled_cascade_allocate(compiled_cascade *cc, unsigned int num_stages,
+                              unsigned int num_parallels,
+                              unsigned int num_classifiers);
+void compiled_cascade_add_group(compiled_cascade *cc, double intercept);
+void compiled_cascade_add(compiled_cascade *cc, const feature_index *fi,
+                          double coef, double thresh, double reject);
+void compiled_cascade_finish(compiled_cascade *cc);
+void compiled_cascade_reset_cache(compiled_cascade *cc);
+int compiled_cascade_share(const compiled_cascade *from, compiled_cascade *to);
+void compiled_cascade_set_fixed(compiled_cascade *cc, int fixed);
+unsigned long long compiled_cascade_fingerprint(const compiled_cascade *cc);
+void compiled_cascade_set_generated(compiled_cascade *cc,
+                                    const generated_cascade *gc);
+
+int compiled_cascade_precomp(compiled_cascade *cc, unsigned int stride);
+int compiled_cascade_precomp_scaled(compiled_cascade *cc, unsigned int stride,
+                                    double scale, unsigned int width,
+                                    unsigned int height);
+double compiled_cascade_evaluate(const compiled_cascade *cc, const sval *sat,
+                                 double factor, int multi_exit,
+                                 double *score, unsigned int *sel,
+                                 unsigned int *depth);
+unsigned int compiled_cascade_evaluate_lanes(const compiled_cascade *cc,
+                                             const sval *sat,
+                                             unsigned int step,
+                                             unsigned int num_lanes,
+                                             unsigned int mask,
+                                             const double *factor,
+                                             int multi_exit, double *val,
+                                             double *score, unsigned int *sel);
+unsigned int compiled_cascade_evaluate_batch(const compiled_cascade *cc,
+                                             const sval *sat, int multi_exit,
+                                             unsigned int stage,
+                                             unsigned int count,
+                                             unsigned int *offset,
+                                             double *factor,
+                                             unsigned int *index,
+                                             double *score,
+                                             unsigned int *sel);
+
+#endif /* __COMPILED_CASCADE_H */
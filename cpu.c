@@ -0,0 +1,94 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "kernels.h"
+#include "utils.h"
+
+static const kernels *cpu_table[CPU_NUM_LEVELS] = {
+	&kernels_scalar, &kernels_sse42, &kernels_avx2, &kernels_avx512
+};
+
+static enum cpu_level cpu_level = CPU_SCALAR;
+static const kernels *cpu_active = NULL;
+static size_t cpu_cache = 0;
+
+enum cpu_level cpu_detect(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return CPU_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return CPU_AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return CPU_SSE42;
+#endif
+	return CPU_SCALAR;
+}
+
+int cpu_select(const char *name)
+{
+	enum cpu_level best;
+	unsigned int level;
+
+	best = cpu_detect();
+	if (!name)
+		name = getenv(CPU_ENV_VARIABLE);
+
+	if (!name || name[0] == '\0' || strcmp(name, "auto") == 0) {
+		level = best;
+	} else {
+		for (level = 0; level < CPU_NUM_LEVELS; level++) {
+			if (strcmp(cpu_table[level]->name, name) == 0)
+				break;
+		}
+
+		if (level == CPU_NUM_LEVELS) {
+			error("unknown instruction set `%s'", name);
+			return FALSE;
+		}
+
+		if (level > best) {
+			error("instruction set `%s' not supported by the cpu",
+			      name);
+			return FALSE;
+		}
+	}
+
+	cpu_level = (enum cpu_level) level;
+	cpu_active = cpu_table[level];
+	return TRUE;
+}
+
+enum cpu_level cpu_get_level(void)
+{
+	return cpu_level;
+}
+
+const kernels *cpu_kernels(void)
+{
+	if (!cpu_active) {
+		if (!cpu_select(NULL))
+			cpu_select("auto");
+	}
+	return cpu_active;
+}
+
+/* Size of the L2 cache, as far as the system tells */
+size_t cpu_cache_size(void)
+{
+	long size;
+
+	if (!cpu_cache) {
+		size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+		size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+		cpu_cache = (size > 0) ? (size_t) size : CPU_DEFAULT_CACHE_SIZE;
+	}
+	return cpu_cache;
+}
@@ -0,0 +1,24 @@
+
+#ifndef __CPU_H
+#define __CPU_H
+
+#include <stddef.h>
+
+#include "kernels.h"
+
+#define CPU_ENV_VARIABLE  "HAARCASCADE_CPU"
+#define CPU_DEFAULT_CACHE_SIZE   (256 * 1024)
+
+/* Data structures and types */
+enum cpu_level {
+	CPU_SCALAR, CPU_SSE42, CPU_AVX2, CPU_AVX512, CPU_NUM_LEVELS
+};
+
+/* Functions */
+enum cpu_level cpu_detect(void);
+int cpu_select(const char *name);
+enum cpu_level cpu_get_level(void);
+const kernels *cpu_kernels(void);
+size_t cpu_cache_size(void);
+
+#endif /* __CPU_H */
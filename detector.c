@@ -111,6 +111,16 @@ void detector_set_params(detector *dt, double scale, double min_stddev,
 	                   match_thresh, overlap_thresh, multi_exit);
 }
 
+unsigned int detector_get_mode(const detector *dt)
+{
+	return cascade_get_mode(&dt->infos[0].c);
+}
+
+void detector_set_mode(detector *dt, unsigned int mode)
+{
+	cascade_set_mode(&dt->infos[0].c, mode);
+}
+
 void detector_set_scan(detector *dt,
                        unsigned int min_width, unsigned int min_height,
                        unsigned int max_width, unsigned int max_height)
@@ -119,12 +129,77 @@ void detector_set_scan(detector *dt,
 	                 max_width, max_height);
 }
 
+void detector_get_grouping(const detector *dt, unsigned int *min_neighbors,
+                           double *group_eps)
+{
+	cascade_get_grouping(&dt->infos[0].c, min_neighbors, group_eps);
+}
+
+void detector_set_grouping(detector *dt, unsigned int min_neighbors,
+                           double group_eps)
+{
+	cascade_set_grouping(&dt->infos[0].c, min_neighbors, group_eps);
+}
+
+void detector_get_adaptive(const detector *dt, unsigned int *dense_depth,
+                           double *skip_margin, unsigned int *skip_windows)
+{
+	cascade_get_adaptive(&dt->infos[0].c, dense_depth, skip_margin,
+	                     skip_windows);
+}
+
+void detector_set_adaptive(detector *dt, unsigned int dense_depth,
+                           double skip_margin, unsigned int skip_windows)
+{
+	cascade_set_adaptive(&dt->infos[0].c, dense_depth, skip_margin,
+	                     skip_windows);
+}
+
+unsigned int detector_get_coarse(const detector *dt)
+{
+	return cascade_get_coarse(&dt->infos[0].c);
+}
+
+void detector_set_coarse(detector *dt, unsigned int coarse_stages)
+{
+	cascade_set_coarse(&dt->infos[0].c, coarse_stages);
+}
+
+unsigned int detector_get_strip(const detector *dt)
+{
+	return cascade_get_strip(&dt->infos[0].c);
+}
+
+void detector_set_strip(detector *dt, unsigned int strip_height)
+{
+	cascade_set_strip(&dt->infos[0].c, strip_height);
+}
+
+int detector_get_pyramid(const detector *dt)
+{
+	return cascade_get_pyramid(&dt->infos[0].c);
+}
+
+void detector_set_pyramid(detector *dt, int pyramid_arena)
+{
+	cascade_set_pyramid(&dt->infos[0].c, pyramid_arena);
+}
+
 int detector_prepare(detector *dt, detector_callback pre_fn,
                      detector_callback post_fn, int enforce_order)
 {
 	unsigned int i;
+	cascade *c;
+
+	/* compiled once; the other slots only point at it */
+	c = &dt->infos[0].c;
+	if (!c->compiled) {
+		if (!cascade_compile(c))
+			return FALSE;
+	}
+
 	for (i = 1; i < dt->num_cascades; i++) {
-		if (!cascade_copy(&dt->infos[0].c, &dt->infos[i].c))
+		if (!cascade_share(c, &dt->infos[i].c))
 			return FALSE;
 	}
 
@@ -296,6 +371,33 @@ int detector_pending(detector *dt, int remaining, int done)
 	return thread_pool_pending(dt->tp, remaining, done);
 }
 
+/*
+ * Scans one image with the first cascade, split over the pool; this
+ * waits only for its own jobs, so queued images may still be pending,
+ * but not one in the first slot.
+ */
+int detector_detect_one(detector *dt, const image *img,
+                        int separate_detected)
+{
+	unsigned int id;
+	cascade *c;
+	int ret;
+
+	for (id = dt->free; id != 0 && id != 1; id = dt->infos[id - 1].next);
+	if (id != 1) {
+		error("the first cascade is busy with a queued image");
+		return FALSE;
+	}
+
+	c = &dt->infos[0].c;
+	cascade_set_thread_pool(c, dt->tp);
+	ret = cascade_set_image(c, img);
+	if (ret)
+		ret = cascade_detect(c, separate_detected);
+	cascade_set_thread_pool(c, NULL);
+	return ret;
+}
+
 int detector_load(detector *dt, const char *filename, int reset,
                   unsigned int num_cascades, unsigned int num_threads)
 {
@@ -50,9 +50,25 @@ void detector_get_params(const detector *dt, double *scale, double *min_stddev,
 void detector_set_params(detector *dt, double scale, double min_stddev,
                          unsigned int step, double match_thresh,
                          double overlap_thresh, int multi_exit);
+unsigned int detector_get_mode(const detector *dt);
+void detector_set_mode(detector *dt, unsigned int mode);
 void detector_set_scan(detector *dt,
                        unsigned int min_width, unsigned int min_height,
                        unsigned int max_width, unsigned int max_height);
+void detector_get_grouping(const detector *dt, unsigned int *min_neighbors,
+                           double *group_eps);
+void detector_set_grouping(detector *dt, unsigned int min_neighbors,
+                           double group_eps);
+void detector_get_adaptive(const detector *dt, unsigned int *dense_depth,
+                           double *skip_margin, unsigned int *skip_windows);
+void detector_set_adaptive(detector *dt, unsigned int dense_depth,
+                           double skip_margin, unsigned int skip_windows);
+unsigned int detector_get_coarse(const detector *dt);
+void detector_set_coarse(detector *dt, unsigned int coarse_stages);
+unsigned int detector_get_strip(const detector *dt);
+void detector_set_strip(detector *dt, unsigned int strip_height);
+int detector_get_pyramid(const detector *dt);
+void detector_set_pyramid(detector *dt, int pyramid_arena);
 
 int detector_prepare(detector *dt, detector_callback pre_fn,
                      detector_callback post_fn, int enforce_order);
@@ -62,6 +78,8 @@ int detector_peek(const detector *dt);
 unsigned int detector_dequeue(detector *dt);
 void detector_release(detector *dt, unsigned int id);
 int detector_pending(detector *dt, int remaining, int done);
+int detector_detect_one(detector *dt, const image *img,
+                        int separate_detected);
 
 int detector_load(detector *dt, const char *filename, int reset,
                   unsigned int num_cascades, unsigned int num_threads);
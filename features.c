@@ -7,8 +7,18 @@
 #include "features.h"
 #include "image.h"
 #include "window.h"
+#include "thread_pool.h"
+#include "cpu.h"
 #include "utils.h"
 
+#define MAX_STRIPS   64
+
+struct strip_st {
+	features *f;
+	const image *img;
+	unsigned int first, last;
+};
+
 void features_reset(features *f)
 {
 	f->sat = NULL;
@@ -54,7 +64,7 @@ int features_allocate(features *f, unsigned int width, unsigned int height,
 	if (nbins == 0 && f->capacity < capacity) {
 		void *ptr, *ptr2;
 		ptr = xmalloc(capacity * sizeof(sval));
-		ptr2 = xmalloc(capacity * sizeof(sval));
+		ptr2 = xmalloc(capacity * sizeof(sval2));
 		if (!ptr || !ptr2) {
 			if (ptr) free(ptr);
 			if (ptr2) free(ptr2);
@@ -65,7 +75,7 @@ int features_allocate(features *f, unsigned int width, unsigned int height,
 		f->sat = (sval *) ptr;
 
 		if (f->sat2) free(f->sat2);
-		f->sat2 = (sval *) ptr2;
+		f->sat2 = (sval2 *) ptr2;
 
 		f->capacity = capacity;
 	}
@@ -91,49 +101,107 @@ int features_allocate(features *f, unsigned int width, unsigned int height,
 
 int features_precompute(features *f, const image *img)
 {
-	unsigned int width, height, stride, istride;
-	unsigned int row, col, pos, ipos;
-	sval *sat, *sat2;
-
 	if (!features_allocate(f, img->width + 1, img->height + 1, 0))
 		return FALSE;
 
-	width = f->width;
-	height = f->height;
-	stride = f->stride;
-	istride = img->stride;
-
-	sat = f->sat;
-	sat2 = f->sat2;
+	cpu_kernels()->integral(img, f, 1, f->height);
+	return TRUE;
+}
 
-	memset(sat, 0, width * sizeof(sval));
-	memset(sat2, 0, width * sizeof(sval));
+static
+void strip_job(void *arg)
+{
+	struct strip_st *st = (struct strip_st *) arg;
+	cpu_kernels()->integral(st->img, st->f, st->first, st->last);
+}
 
-	for (row = 1; row < height; row++) {
-		ipos = istride * (row - 1);
-		pos = stride * row;
-		sat[pos] = 0;
-		sat2[pos] = 0;
+static
+void carry_job(void *arg)
+{
+	struct strip_st *st = (struct strip_st *) arg;
+	unsigned int row, col, width, stride;
+	const sval *carry;
+	const sval2 *carry2;
+	sval *sat;
+	sval2 *sat2;
+
+	width = st->f->width;
+	stride = st->f->stride;
+	carry = &st->f->sat[stride * (st->first - 1)];
+	carry2 = &st->f->sat2[stride * (st->first - 1)];
+
+	for (row = st->first; row < st->last - 1; row++) {
+		sat = &st->f->sat[stride * row];
+		sat2 = &st->f->sat2[stride * row];
 		for (col = 1; col < width; col++) {
-			sval val;
+			sat[col] += carry[col];
+			sat2[col] += carry2[col];
+		}
+	}
+}
 
-			val = (sval) img->pixels[ipos];
-			sat[pos + 1] = sat[pos] + val;
-			sat2[pos + 1] = sat2[pos] + (val * val);
+int features_precompute_strips(features *f, const image *img,
+                               thread_pool *tp, unsigned int num_strips)
+{
+	struct strip_st strips[MAX_STRIPS];
+	unsigned int i, col, rows, width, stride, running;
+	sval *last;
+	sval2 *last2;
+	const sval *carry;
+	const sval2 *carry2;
+
+	num_strips = MIN(num_strips, MAX_STRIPS);
+	num_strips = MIN(num_strips, img->height);
+	if (!tp || num_strips <= 1)
+		return features_precompute(f, img);
 
-			ipos++;
-			pos++;
-		}
+	if (!features_allocate(f, img->width + 1, img->height + 1, 0))
+		return FALSE;
+
+	running = 0;
+	rows = img->height / num_strips;
+	for (i = 0; i < num_strips; i++) {
+		strips[i].f = f;
+		strips[i].img = img;
+		strips[i].first = 1 + i * rows;
+		strips[i].last = (i == num_strips - 1) ? f->height
+		                  : 1 + (i + 1) * rows;
+		if (!thread_pool_enqueue_count(tp, &strip_job, &strips[i],
+		                               &running))
+			strip_job(&strips[i]);
 	}
+	thread_pool_wait_count(tp, &running);
 
-	for (col = 1; col < width; col++) {
-		pos = col + stride;
-		for (row = 2; row < height; row++) {
-			sat[pos + stride] += sat[pos];
-			sat2[pos + stride] += sat2[pos];
-			pos += stride;
+	width = f->width;
+	stride = f->stride;
+	for (i = 1; i < num_strips; i++) {
+		carry = &f->sat[stride * (strips[i].first - 1)];
+		carry2 = &f->sat2[stride * (strips[i].first - 1)];
+		last = &f->sat[stride * (strips[i].last - 1)];
+		last2 = &f->sat2[stride * (strips[i].last - 1)];
+		for (col = 1; col < width; col++) {
+			last[col] += carry[col];
+			last2[col] += carry2[col];
 		}
 	}
+
+	for (i = 1; i < num_strips; i++) {
+		if (!thread_pool_enqueue_count(tp, &carry_job, &strips[i],
+		                               &running))
+			carry_job(&strips[i]);
+	}
+	thread_pool_wait_count(tp, &running);
+	return TRUE;
+}
+
+int features_precompute_resized(features *f, const image *img,
+                                unsigned int width, unsigned int height,
+                                unsigned int top, unsigned int num_rows)
+{
+	if (!features_allocate(f, width + 1, num_rows + 1, 0))
+		return FALSE;
+
+	cpu_kernels()->resize_integral(img, f, height, top);
 	return TRUE;
 }
 
@@ -229,6 +297,34 @@ sval rectangle_sum(const sval *sat, unsigned int stride,
 	return sum;
 }
 
+static
+double rectangle_sum2(const sval2 *sat2, unsigned int stride,
+                      unsigned int left, unsigned int top,
+                      unsigned int width, unsigned int height)
+{
+	unsigned int pos;
+	double total;
+	sval2 sum;
+
+	total = 0;
+#if !defined(SVAL_DOUBLE) && !defined(SAT2_WIDE)
+	if (width * height > SAT2_MAX_AREA) {
+		unsigned int rows;
+		rows = MAX(1, SAT2_MAX_AREA / width);
+		for (; height > rows; height -= rows, top += rows)
+			total += rectangle_sum2(sat2, stride, left, top,
+			                        width, rows);
+	}
+#endif
+
+	pos = stride * top + left;
+	sum = sat2[pos];
+	sum += sat2[pos + stride * height + width];
+	sum -= sat2[pos + width];
+	sum -= sat2[pos + stride * height];
+	return total + (double) sum;
+}
+
 static
 void rectangle_sum_hog(const sval *hog, sval *out,
                        unsigned int stride, unsigned int nbins,
@@ -258,8 +354,8 @@ double features_stddev(const features *f, const window *w)
 
 	avg = (double) rectangle_sum(f->sat, stride, w->left, w->top,
 	                             w->width, w->height);
-	avg2 = (double) rectangle_sum(f->sat2, stride, w->left, w->top,
-	                              w->width, w->height);
+	avg2 = rectangle_sum2(f->sat2, stride, w->left, w->top,
+	                      w->width, w->height);
 	avg /= n;
 	avg2 /= n;
 	var = avg2 - (avg * avg);
@@ -268,6 +364,15 @@ double features_stddev(const features *f, const window *w)
 	return sqrt(var);
 }
 
+unsigned int features_stddev_row(const features *f, const window *w,
+                                 unsigned int step, unsigned int count,
+                                 double min_stddev, unsigned int *left,
+                                 double *factor)
+{
+	return cpu_kernels()->stddev_row(f, w, step, count, min_stddev,
+	                                 left, factor);
+}
+
 void features_crop(const features *f, const window *w, double alpha,
                    sval *sat, unsigned int stride)
 {
@@ -515,10 +620,45 @@ void optimize_aux(void *arg, sval weight, unsigned int pos)
 int features_optimize(const feature_index *fi, feature_index_opt *fo,
                       unsigned int stride)
 {
+	fo->cell.idx = -1;
+	fo->cell.offset = fi->w.top * stride + fi->w.left;
+	fo->cell.dx = fi->w.width;
+	fo->cell.dy = fi->w.height * stride;
+	if (fi->idx >= 0 && fi->idx < NUM_HAAR_TYPES)
+		fo->cell.idx = fi->idx;
+
 	fo->num_opt_points = 0;
 	return features_emit_sat(fi, stride, &optimize_aux, fo);
 }
 
+double features_scale(const feature_index *fi, feature_index *sfi,
+                      double scale, unsigned int width, unsigned int height)
+{
+	static const unsigned int cells[8][2] = {
+		{ 2, 1 }, { 1, 2 }, { 3, 1 }, { 4, 1 },
+		{ 1, 3 }, { 1, 4 }, { 3, 3 }, { 2, 2 }
+	};
+	unsigned int mx, my;
+	double area;
+
+	mx = cells[fi->idx & 7][0];
+	my = cells[fi->idx & 7][1];
+
+	sfi->idx = fi->idx;
+	sfi->w.width = (unsigned int) floor(0.5 + scale * fi->w.width);
+	sfi->w.height = (unsigned int) floor(0.5 + scale * fi->w.height);
+	sfi->w.width = MAX(1, MIN(sfi->w.width, width / mx));
+	sfi->w.height = MAX(1, MIN(sfi->w.height, height / my));
+
+	sfi->w.left = (unsigned int) floor(0.5 + scale * fi->w.left);
+	sfi->w.top = (unsigned int) floor(0.5 + scale * fi->w.top);
+	sfi->w.left = MIN(sfi->w.left, width - mx * sfi->w.width);
+	sfi->w.top = MIN(sfi->w.top, height - my * sfi->w.height);
+
+	area = ((double) sfi->w.width) * sfi->w.height;
+	return area / (((double) fi->w.width) * fi->w.height);
+}
+
 double features_evaluate_fast(const sval *sat, const feature_index_opt *fo)
 {
 	unsigned int i;
@@ -531,6 +671,12 @@ double features_evaluate_fast(const sval *sat, const feature_index_opt *fo)
 	return ((double) val);
 }
 
+void features_evaluate_samples(sval *const *sat, unsigned int n,
+                               const feature_index_opt *fo, double *vals)
+{
+	cpu_kernels()->evaluate_samples(sat, n, fo, vals);
+}
+
 void feature_enumerator_start(feature_enumerator *fe, unsigned int width,
                               unsigned int height, int use_hog)
 {
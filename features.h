@@ -4,14 +4,23 @@
 
 #include "image.h"
 #include "window.h"
+#include "thread_pool.h"
 
 #define MAX_OPT_POINTS    12
+#define NUM_HAAR_TYPES    8
+#define SAT2_MAX_AREA     66051
 
 /* Data structures and types */
 #ifdef SVAL_DOUBLE
 typedef double sval;
+typedef double sval2;
 #else
 typedef int sval;
+#ifdef SAT2_WIDE
+typedef long long sval2;
+#else
+typedef unsigned int sval2;
+#endif
 #endif
 
 typedef
@@ -20,7 +29,8 @@ struct features_st {
 	unsigned int capacity;
 	unsigned int capacity_hog;
 	unsigned int nbins;
-	sval *sat, *sat2;
+	sval *sat;
+	sval2 *sat2;
 	sval *hog;
 } features;
 
@@ -30,8 +40,15 @@ struct feature_index_st {
 	window w;
 } feature_index;
 
+typedef
+struct feature_cell_st {
+	int idx;
+	unsigned int offset, dx, dy;
+} feature_cell;
+
 typedef
 struct feature_index_opt_st {
+	feature_cell cell;
 	unsigned int num_opt_points;
 	unsigned int point[MAX_OPT_POINTS];
 	sval weight[MAX_OPT_POINTS];
@@ -58,10 +75,19 @@ void features_reset(features *f);
 void features_init(features *f);
 void features_cleanup(features *f);
 int features_precompute(features *f, const image *img);
+int features_precompute_strips(features *f, const image *img,
+                               thread_pool *tp, unsigned int num_strips);
+int features_precompute_resized(features *f, const image *img,
+                                unsigned int width, unsigned int height,
+                                unsigned int top, unsigned int num_rows);
 int features_precompute_hog(features *f, const image *img,
                             unsigned int nbins);
 
 double features_stddev(const features *f, const window *w);
+unsigned int features_stddev_row(const features *f, const window *w,
+                                 unsigned int step, unsigned int count,
+                                 double min_stddev, unsigned int *left,
+                                 double *factor);
 void features_crop(const features *f, const window *w, double alpha,
                    sval *sat, unsigned int stride);
 void features_crop_hog(const features *f, const window *w,
@@ -78,8 +104,12 @@ int features_emit_sat(const feature_index *fi, unsigned int stride,
                       features_sat_cb cb, void *arg);
 int features_optimize(const feature_index *fi, feature_index_opt *fo,
                       unsigned int stride);
+double features_scale(const feature_index *fi, feature_index *sfi,
+                      double scale, unsigned int width, unsigned int height);
 
 double features_evaluate_fast(const sval *sat, const feature_index_opt *fo);
+void features_evaluate_samples(sval *const *sat, unsigned int n,
+                               const feature_index_opt *fo, double *vals);
 
 void feature_enumerator_start(feature_enumerator *fe, unsigned int width,
                               unsigned int height, int use_hog);
@@ -0,0 +1,35 @@
+
+#include <stdlib.h>
+
+#include "generated.h"
+
+static generated_cascade *generated_list = NULL;
+
+void generated_register(generated_cascade *gc)
+{
+	gc->next = generated_list;
+	generated_list = gc;
+}
+
+const generated_cascade *generated_find(unsigned long long fingerprint)
+{
+	const generated_cascade *gc;
+
+	for (gc = generated_list; gc; gc = gc->next) {
+		if (gc->fingerprint == fingerprint)
+			return gc;
+	}
+	return NULL;
+}
+
+unsigned int generated_best(const double *score, unsigned int num_parallels)
+{
+	unsigned int k, best;
+
+	best = 0;
+	for (k = 1; k < num_parallels; k++) {
+		if (score[k] > score[best])
+			best = k;
+	}
+	return best;
+}
@@ -0,0 +1,31 @@
+
+#ifndef __GENERATED_H
+#define __GENERATED_H
+
+#include <math.h>
+
+#include "features.h"
+
+/* Data structures and types */
+typedef double (*generated_evaluate)(const sval *sat, unsigned int stride,
+                                     double factor, int multi_exit,
+                                     double *score, unsigned int *sel);
+
+/*
+ * A cascade written as C source by "haarcascade compile" and linked
+ * into the program; each one registers itself before main() runs.
+ */
+typedef
+struct generated_cascade_st {
+	const char *name;
+	unsigned long long fingerprint;
+	generated_evaluate evaluate;
+	struct generated_cascade_st *next;
+} generated_cascade;
+
+/* Functions */
+void generated_register(generated_cascade *gc);
+const generated_cascade *generated_find(unsigned long long fingerprint);
+unsigned int generated_best(const double *score, unsigned int num_parallels);
+
+#endif /* __GENERATED_H */
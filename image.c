@@ -11,6 +11,7 @@
 
 #include "image.h"
 #include "window.h"
+#include "cpu.h"
 #include "utils.h"
 
 void image_reset(image *img)
@@ -54,6 +55,18 @@ int image_allocate(image *img, unsigned int width, unsigned int height)
 	return TRUE;
 }
 
+/* Makes img refer to pixels it doesn't own, so it must not be cleaned up;
+ * resizing it to at most width by height pixels writes them in place */
+void image_view(image *img, unsigned char *pixels,
+                unsigned int width, unsigned int height)
+{
+	img->pixels = pixels;
+	img->width = width;
+	img->height = height;
+	img->stride = width;
+	img->capacity = width * height;
+}
+
 int image_copy(const image *from, image *to)
 {
 	if (!image_allocate(to, from->width, from->height))
@@ -75,100 +88,47 @@ int image_copy(const image *from, image *to)
 int image_resize(const image *img, image *t,
                  unsigned int width, unsigned int height)
 {
-	unsigned int row, col, trow, tcol, pos, tpos;
-	unsigned int stride, tstride;
-	unsigned int drow, dcol;
-	unsigned char *pxls;
-#ifdef USE_LINEAR_FILTER
-	double x, y, dx, dy;
-#else
-	unsigned int x, y, dx, dy;
-#endif
-
-	if (!image_allocate(t, width, height))
+	return image_resize_rows(img, t, width, height, 0, height);
+}
+
+int image_resize_rows(const image *img, image *t,
+                      unsigned int width, unsigned int height,
+                      unsigned int top, unsigned int num_rows)
+{
+	if (!image_allocate(t, width, num_rows))
 		return FALSE;
 
-	stride = img->stride;
-	tstride = t->stride;
-
-	drow = img->height / height;
-	dcol = img->width / width;
-
-#ifdef USE_LINEAR_FILTER
-	dy = ((double) img->height) / height;
-	dy -= drow;
-	dx = ((double) img->width) / width;
-	dx -= dcol;
-#else
-	dy = img->height % height;
-	dx = img->width % width;
-#endif
-
-	pxls = img->pixels;
-	row = 0;
-	y = 0;
-	for (trow = 0; trow < height; trow++) {
-		col = 0;
-		x = 0;
-		for (tcol = 0; tcol < width; tcol++) {
-#ifdef USE_LINEAR_FILTER
-			double val;
-#endif
-			pos = stride * row + col;
-			tpos = tstride * trow + tcol;
-#ifdef USE_LINEAR_FILTER
-			val = (1 - x) * (1 - y) * ((double) pxls[pos]);
-
-			if (x > EPS) {
-				if (y > EPS) {
-					val += x * (1 - y)
-					 * ((double) pxls[pos + 1]);
-					val += y * (1 - x)
-					 * ((double) pxls[pos + stride]);
-					val += x * y
-					 * ((double) pxls[pos + stride + 1]);
-				} else {
-					val += x
-					 * ((double) pxls[pos + 1]);
-				}
-			} else {
-				if (y > EPS) {
-					val += y
-					 * ((double) pxls[pos + stride]);
-				}
-			}
-			t->pixels[tpos] = (unsigned char) val;
-#else /* !USE_LINEAR_FILTER */
-			t->pixels[tpos] = pxls[pos];
-#endif
-
-			col += dcol;
-			x += dx;
-#ifdef USE_LINEAR_FILTER
-			if (x >= 1) {
-				x -= 1;
-#else
-			if (x >= width) {
-				x -= width;
-#endif
-				col++;
-			}
-		}
+	cpu_kernels()->resize(img, t, height, top);
+	return TRUE;
+}
+
+/* Halves an image, each pixel being the rounded mean of a 2x2 block;
+ * an odd last row or column is replicated, so that pixel k always
+ * covers pixels 2k and 2k + 1 of the original */
+int image_halve(const image *img, image *t)
+{
+	unsigned int row, col, half;
+	const unsigned char *p0, *p1;
+	unsigned char *q;
 
-		row += drow;
-		y += dy;
-#ifdef USE_LINEAR_FILTER
-		if (y >= 1) {
-			y -= 1;
-#else
-		if (y >= height) {
-			y -= height;
-#endif
-			row++;
+	if (!image_allocate(t, (img->width + 1) / 2, (img->height + 1) / 2))
+		return FALSE;
+
+	half = img->width / 2;
+	for (row = 0; row < t->height; row++) {
+		p0 = &img->pixels[2 * row * img->stride];
+		p1 = (2 * row + 1 < img->height) ? p0 + img->stride : p0;
+		q = &t->pixels[row * t->stride];
+		for (col = 0; col < half; col++) {
+			q[col] = (unsigned char) ((p0[2 * col] + p0[2 * col + 1]
+			                           + p1[2 * col] + p1[2 * col + 1]
+			                           + 2) >> 2);
+		}
+		if (half < t->width) {
+			q[half] = (unsigned char) ((p0[2 * half] + p1[2 * half]
+			                            + 1) >> 1);
 		}
 	}
-
-	return TRUE;
 	return TRUE;
 }
 
@@ -16,10 +16,16 @@ void image_reset(image *img);
 void image_init(image *img);
 int image_allocate(image *img, unsigned int width, unsigned int height);
 void image_cleanup(image *img);
+void image_view(image *img, unsigned char *pixels,
+                unsigned int width, unsigned int height);
 
 int image_copy(const image *from, image *to);
 int image_resize(const image *img, image *t,
                  unsigned int width, unsigned int height);
+int image_resize_rows(const image *img, image *t,
+                      unsigned int width, unsigned int height,
+                      unsigned int top, unsigned int num_rows);
+int image_halve(const image *img, image *t);
 
 int image_read(image *img, const char *filename);
 int image_write(const image *img, const char *filename);
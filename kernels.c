@@ -0,0 +1,1750 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#if (defined(__SSE4_1__) || defined(__AVX2__)) && !defined(SVAL_DOUBLE)
+#include <immintrin.h>
+#endif
+
+#include "kernels.h"
+#include "compiled_cascade.h"
+#include "boosting.h"
+#include "features.h"
+#include "image.h"
+#include "utils.h"
+
+/*
+ * This file is compiled once per instruction set, with KERNEL_SUFFIX
+ * naming the resulting table of kernels (see cpu.c).
+ */
+#ifndef KERNEL_SUFFIX
+#define KERNEL_SUFFIX scalar
+#endif
+
+#define KERNEL_CAT(a, b) a##_##b
+#define KERNEL_NAME(a, b) KERNEL_CAT(a, b)
+#define KERNEL_STR(a) #a
+#define KERNEL_XSTR(a) KERNEL_STR(a)
+
+#define TAU (EPS * EPS)
+#define SCALAR_LANES     3
+
+#define SPAN_LENGTH    256
+
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE)
+static inline
+__m256i prefix_sum(__m256i x)
+{
+	__m256i t;
+
+	x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+	x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+	t = _mm256_shuffle_epi32(x, 0xFF);
+	t = _mm256_permute2x128_si256(t, t, 0x08);
+	return _mm256_add_epi32(x, t);
+}
+#elif defined(__SSE4_1__) && !defined(SVAL_DOUBLE)
+static inline
+__m128i prefix_sum(__m128i x)
+{
+	x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+	return _mm_add_epi32(x, _mm_slli_si128(x, 8));
+}
+#endif
+
+static
+void integral_span(const unsigned char *px, unsigned int n,
+                   const sval *prev, const sval2 *prev2,
+                   sval *cur, sval2 *cur2, sval *psum, sval2 *psum2)
+{
+	unsigned int i;
+	sval val, sum;
+	sval2 sum2;
+
+	i = 0;
+	sum = *psum;
+	sum2 = *psum2;
+
+	if (!prev) {
+		for (; i < n; i++) {
+			val = (sval) px[i];
+			sum += val;
+			sum2 += (sval2) (val * val);
+			cur[i] = sum;
+			cur2[i] = sum2;
+		}
+		*psum = sum;
+		*psum2 = sum2;
+		return;
+	}
+
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE) && !defined(SAT2_WIDE)
+	if (n >= 8) {
+		__m256i c, c2, x, x2, last;
+		long long l;
+
+		c = _mm256_set1_epi32(sum);
+		c2 = _mm256_set1_epi32((int) sum2);
+		last = _mm256_set1_epi32(7);
+		for (; i + 8 <= n; i += 8) {
+			memcpy(&l, &px[i], sizeof(l));
+			x = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(l));
+			x2 = _mm256_mullo_epi32(x, x);
+			x = _mm256_add_epi32(prefix_sum(x), c);
+			x2 = _mm256_add_epi32(prefix_sum(x2), c2);
+			c = _mm256_permutevar8x32_epi32(x, last);
+			c2 = _mm256_permutevar8x32_epi32(x2, last);
+
+			x = _mm256_add_epi32(x, _mm256_loadu_si256(
+			                          (const __m256i *) &prev[i]));
+			x2 = _mm256_add_epi32(x2, _mm256_loadu_si256(
+			                          (const __m256i *) &prev2[i]));
+			_mm256_storeu_si256((__m256i *) &cur[i], x);
+			_mm256_storeu_si256((__m256i *) &cur2[i], x2);
+		}
+		sum = _mm256_cvtsi256_si32(c);
+		sum2 = (sval2) _mm256_cvtsi256_si32(c2);
+	}
+#elif defined(__SSE4_1__) && !defined(SVAL_DOUBLE) && !defined(SAT2_WIDE)
+	if (n >= 4) {
+		__m128i c, c2, x, x2;
+		int l;
+
+		c = _mm_set1_epi32(sum);
+		c2 = _mm_set1_epi32((int) sum2);
+		for (; i + 4 <= n; i += 4) {
+			memcpy(&l, &px[i], sizeof(l));
+			x = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(l));
+			x2 = _mm_mullo_epi32(x, x);
+			x = _mm_add_epi32(prefix_sum(x), c);
+			x2 = _mm_add_epi32(prefix_sum(x2), c2);
+			c = _mm_shuffle_epi32(x, 0xFF);
+			c2 = _mm_shuffle_epi32(x2, 0xFF);
+
+			x = _mm_add_epi32(x, _mm_loadu_si128(
+			                       (const __m128i *) &prev[i]));
+			x2 = _mm_add_epi32(x2, _mm_loadu_si128(
+			                       (const __m128i *) &prev2[i]));
+			_mm_storeu_si128((__m128i *) &cur[i], x);
+			_mm_storeu_si128((__m128i *) &cur2[i], x2);
+		}
+		sum = _mm_cvtsi128_si32(c);
+		sum2 = (sval2) _mm_cvtsi128_si32(c2);
+	}
+#endif
+
+	for (; i < n; i++) {
+		val = (sval) px[i];
+		sum += val;
+		sum2 += (sval2) (val * val);
+		cur[i] = prev[i] + sum;
+		cur2[i] = prev2[i] + sum2;
+	}
+	*psum = sum;
+	*psum2 = sum2;
+}
+
+static
+void integral(const image *img, features *f, unsigned int first,
+              unsigned int last)
+{
+	unsigned int width, stride, istride, row, pos;
+	const sval *prev;
+	const sval2 *prev2;
+	sval *sat, sum;
+	sval2 *sat2, sum2;
+
+	width = f->width;
+	stride = f->stride;
+	istride = img->stride;
+
+	sat = f->sat;
+	sat2 = f->sat2;
+
+	if (first == 1) {
+		memset(sat, 0, width * sizeof(sval));
+		memset(sat2, 0, width * sizeof(sval2));
+	}
+
+	for (row = first; row < last; row++) {
+		pos = stride * row;
+		sat[pos] = 0;
+		sat2[pos] = 0;
+
+		prev = NULL;
+		prev2 = NULL;
+		if (row > first) {
+			prev = &sat[pos - stride + 1];
+			prev2 = &sat2[pos - stride + 1];
+		}
+
+		sum = 0;
+		sum2 = 0;
+		integral_span(&img->pixels[istride * (row - 1)], width - 1,
+		              prev, prev2, &sat[pos + 1], &sat2[pos + 1],
+		              &sum, &sum2);
+	}
+}
+
+#ifdef USE_LINEAR_FILTER
+static inline
+unsigned char linear_pixel(const unsigned char *pxls, unsigned int stride,
+                           unsigned int pos, double x, double y)
+{
+	double val;
+
+	val = (1 - x) * (1 - y) * ((double) pxls[pos]);
+	if (x > EPS) {
+		if (y > EPS) {
+			val += x * (1 - y) * ((double) pxls[pos + 1]);
+			val += y * (1 - x) * ((double) pxls[pos + stride]);
+			val += x * y * ((double) pxls[pos + stride + 1]);
+		} else {
+			val += x * ((double) pxls[pos + 1]);
+		}
+	} else {
+		if (y > EPS) {
+			val += y * ((double) pxls[pos + stride]);
+		}
+	}
+	return (unsigned char) val;
+}
+#endif
+
+static
+void resize(const image *img, image *t, unsigned int height,
+            unsigned int top)
+{
+	unsigned int row, col, trow, tcol, pos, tpos;
+	unsigned int stride, tstride;
+	unsigned int width, bottom;
+	unsigned int drow, dcol;
+	unsigned char *pxls;
+#ifdef USE_LINEAR_FILTER
+	double x, y, dx, dy;
+#else
+	unsigned int x, y, dx, dy;
+#endif
+
+	width = t->width;
+	bottom = top + t->height;
+	stride = img->stride;
+	tstride = t->stride;
+
+	drow = img->height / height;
+	dcol = img->width / width;
+
+#ifdef USE_LINEAR_FILTER
+	dy = ((double) img->height) / height;
+	dy -= drow;
+	dx = ((double) img->width) / width;
+	dx -= dcol;
+#else
+	dy = img->height % height;
+	dx = img->width % width;
+#endif
+
+	pxls = img->pixels;
+	row = 0;
+	y = 0;
+	for (trow = 0; trow < bottom; trow++) {
+		col = 0;
+		x = 0;
+		for (tcol = 0; trow >= top && tcol < width; tcol++) {
+			pos = stride * row + col;
+			tpos = tstride * (trow - top) + tcol;
+#ifdef USE_LINEAR_FILTER
+			t->pixels[tpos] = linear_pixel(pxls, stride, pos, x, y);
+#else
+			t->pixels[tpos] = pxls[pos];
+#endif
+
+			col += dcol;
+			x += dx;
+#ifdef USE_LINEAR_FILTER
+			if (x >= 1) {
+				x -= 1;
+#else
+			if (x >= width) {
+				x -= width;
+#endif
+				col++;
+			}
+		}
+
+		row += drow;
+		y += dy;
+#ifdef USE_LINEAR_FILTER
+		if (y >= 1) {
+			y -= 1;
+#else
+		if (y >= height) {
+			y -= height;
+#endif
+			row++;
+		}
+	}
+}
+
+static
+void resize_integral(const image *img, features *f, unsigned int height,
+                     unsigned int top)
+{
+	unsigned char span[SPAN_LENGTH];
+	unsigned int row, col, trow, tcol, pos, spos, len;
+	unsigned int stride, istride;
+	unsigned int width, bottom;
+	unsigned int drow, dcol;
+	unsigned char *pxls;
+	sval *sat, sum;
+	sval2 *sat2, sum2;
+#ifdef USE_LINEAR_FILTER
+	double x, y, dx, dy;
+#else
+	unsigned int x, y, dx, dy;
+#endif
+
+	width = f->width - 1;
+	bottom = top + f->height - 1;
+	istride = img->stride;
+	stride = f->stride;
+
+	drow = img->height / height;
+	dcol = img->width / width;
+
+#ifdef USE_LINEAR_FILTER
+	dy = ((double) img->height) / height;
+	dy -= drow;
+	dx = ((double) img->width) / width;
+	dx -= dcol;
+#else
+	dy = img->height % height;
+	dx = img->width % width;
+#endif
+
+	sat = f->sat;
+	sat2 = f->sat2;
+	memset(sat, 0, f->width * sizeof(sval));
+	memset(sat2, 0, f->width * sizeof(sval2));
+
+	pxls = img->pixels;
+	row = 0;
+	y = 0;
+	for (trow = 0; trow < bottom; trow++) {
+		if (trow >= top) {
+			spos = stride * (trow - top + 1);
+			sat[spos] = 0;
+			sat2[spos] = 0;
+			sum = 0;
+			sum2 = 0;
+
+			col = 0;
+			x = 0;
+			len = 0;
+			for (tcol = 0; tcol < width; tcol++) {
+				pos = istride * row + col;
+#ifdef USE_LINEAR_FILTER
+				span[len++] = linear_pixel(pxls, istride, pos,
+				                           x, y);
+#else
+				span[len++] = pxls[pos];
+#endif
+				if (len == SPAN_LENGTH || tcol == width - 1) {
+					integral_span(span, len,
+					              &sat[spos + 1 - stride],
+					              &sat2[spos + 1 - stride],
+					              &sat[spos + 1],
+					              &sat2[spos + 1],
+					              &sum, &sum2);
+					spos += len;
+					len = 0;
+				}
+
+				col += dcol;
+				x += dx;
+#ifdef USE_LINEAR_FILTER
+				if (x >= 1) {
+					x -= 1;
+#else
+				if (x >= width) {
+					x -= width;
+#endif
+					col++;
+				}
+			}
+		}
+
+		row += drow;
+		y += dy;
+#ifdef USE_LINEAR_FILTER
+		if (y >= 1) {
+			y -= 1;
+#else
+		if (y >= height) {
+			y -= height;
+#endif
+			row++;
+		}
+	}
+}
+
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE) && !defined(SAT2_WIDE)
+static inline
+__m256i box_sums(const int *s, unsigned int pos, unsigned int right,
+                 unsigned int down, unsigned int step, __m256i idx)
+{
+	__m256i a, b, c, d;
+
+	if (step == 1) {
+		a = _mm256_loadu_si256((const __m256i *) &s[pos]);
+		b = _mm256_loadu_si256((const __m256i *) &s[pos + right]);
+		c = _mm256_loadu_si256((const __m256i *) &s[pos + down]);
+		d = _mm256_loadu_si256((const __m256i *) &s[pos + down + right]);
+	} else {
+		a = _mm256_i32gather_epi32(&s[pos], idx, 4);
+		b = _mm256_i32gather_epi32(&s[pos + right], idx, 4);
+		c = _mm256_i32gather_epi32(&s[pos + down], idx, 4);
+		d = _mm256_i32gather_epi32(&s[pos + down + right], idx, 4);
+	}
+	return _mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(a, d), b), c);
+}
+
+static inline
+__m256d box_variance(__m128i s, __m128i s2, __m256d n)
+{
+	__m256d avg, avg2;
+
+	avg = _mm256_div_pd(_mm256_cvtepi32_pd(s), n);
+	s2 = _mm_xor_si128(s2, _mm_set1_epi32(-2147483647 - 1));
+	avg2 = _mm256_add_pd(_mm256_cvtepi32_pd(s2),
+	                     _mm256_set1_pd(2147483648.0));
+	avg2 = _mm256_div_pd(avg2, n);
+	return _mm256_sub_pd(avg2, _mm256_mul_pd(avg, avg));
+}
+#endif
+
+/*
+ * The vector path rejects windows by comparing the variance against a
+ * threshold slightly below min_stddev^2, so every window it drops would
+ * also fail features_stddev; the survivors take the exact test.
+ */
+static
+unsigned int stddev_row(const features *f, const window *w,
+                        unsigned int step, unsigned int count,
+                        double min_stddev, unsigned int *left,
+                        double *factor)
+{
+	unsigned int i, num;
+	double stddev;
+	window inner;
+
+	i = 0;
+	num = 0;
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE) && !defined(SAT2_WIDE)
+	if (min_stddev >= 0 && w->width * w->height <= SAT2_MAX_AREA) {
+		unsigned int j, pos, right, down, mask;
+		double var[8], thresh;
+		__m256i idx, s, s2;
+		__m256d n, lo, hi, t;
+
+		thresh = min_stddev * min_stddev * (1 - 1e-9);
+		t = _mm256_set1_pd(thresh);
+		n = _mm256_set1_pd((double) (w->width * w->height));
+		idx = _mm256_mullo_epi32(_mm256_set1_epi32((int) step),
+		                         _mm256_setr_epi32(0, 1, 2, 3,
+		                                           4, 5, 6, 7));
+		right = w->width;
+		down = f->stride * w->height;
+		for (; i + 8 <= count; i += 8) {
+			pos = f->stride * w->top + w->left + i * step;
+			s = box_sums(f->sat, pos, right, down, step, idx);
+			s2 = box_sums((const int *) f->sat2, pos, right, down,
+			              step, idx);
+
+			lo = box_variance(_mm256_castsi256_si128(s),
+			                  _mm256_castsi256_si128(s2), n);
+			hi = box_variance(_mm256_extracti128_si256(s, 1),
+			                  _mm256_extracti128_si256(s2, 1), n);
+			mask = (unsigned int) _mm256_movemask_pd(
+			          _mm256_cmp_pd(lo, t, _CMP_GT_OQ));
+			mask |= (unsigned int) _mm256_movemask_pd(
+			          _mm256_cmp_pd(hi, t, _CMP_GT_OQ)) << 4;
+			if (!mask) continue;
+
+			_mm256_storeu_pd(&var[0], lo);
+			_mm256_storeu_pd(&var[4], hi);
+			for (j = 0; j < 8; j++) {
+				if (!(mask & (1u << j))) continue;
+
+				stddev = sqrt(var[j]);
+				if (stddev <= min_stddev) continue;
+
+				left[num] = w->left + (i + j) * step;
+				factor[num++] = stddev;
+			}
+		}
+	}
+#endif
+
+	inner = *w;
+	for (; i < count; i++) {
+		inner.left = w->left + i * step;
+		stddev = features_stddev(f, &inner);
+		if (stddev <= min_stddev) continue;
+
+		left[num] = inner.left;
+		factor[num++] = stddev;
+	}
+	return num;
+}
+
+#define MAX_HAAR_POINTS   9
+
+/*
+ * Corners of each Haar feature type on the grid spanned by its cell
+ * (dx columns by dy rows), with the weights of the corners shared by
+ * adjacent rectangles already merged.
+ */
+typedef
+struct haar_cells_st {
+	unsigned int num_points;
+	unsigned int x[MAX_HAAR_POINTS], y[MAX_HAAR_POINTS];
+	sval weight[MAX_HAAR_POINTS];
+} haar_cells;
+
+static const haar_cells haar_table[NUM_HAAR_TYPES] = {
+	{ 6, { 0, 1, 2, 0, 1, 2 }, { 0, 0, 0, 1, 1, 1 },
+	  { 1, -2, 1, -1, 2, -1 } },
+	{ 6, { 0, 1, 0, 1, 0, 1 }, { 0, 0, 1, 1, 2, 2 },
+	  { 1, -1, -2, 2, 1, -1 } },
+	{ 8, { 0, 3, 0, 3, 1, 2, 2, 1 }, { 0, 0, 1, 1, 0, 1, 0, 1 },
+	  { 1, -1, -1, 1, -3, -3, 3, 3 } },
+	{ 8, { 0, 4, 0, 4, 1, 3, 3, 1 }, { 0, 0, 1, 1, 0, 1, 0, 1 },
+	  { 1, -1, -1, 1, -2, -2, 2, 2 } },
+	{ 8, { 0, 1, 1, 0, 0, 1, 1, 0 }, { 0, 3, 0, 3, 1, 2, 1, 2 },
+	  { 1, 1, -1, -1, -3, -3, 3, 3 } },
+	{ 8, { 0, 1, 1, 0, 0, 1, 1, 0 }, { 0, 4, 0, 4, 1, 3, 1, 3 },
+	  { 1, 1, -1, -1, -2, -2, 2, 2 } },
+	{ 8, { 0, 3, 3, 0, 1, 2, 2, 1 }, { 0, 3, 0, 3, 1, 2, 1, 2 },
+	  { 1, 1, -1, -1, -9, -9, 9, 9 } },
+	{ 9, { 0, 1, 1, 0, 2, 2, 1, 2, 0 }, { 0, 1, 0, 1, 2, 1, 2, 0, 2 },
+	  { 1, 4, -2, -2, 1, -2, -2, 1, 1 } }
+};
+
+static inline
+sval haar_value(const sval *s, unsigned int dx, unsigned int dy,
+                const haar_cells *hc)
+{
+	unsigned int p;
+	sval t;
+
+	t = 0;
+	for (p = 0; p < hc->num_points; p++)
+		t += hc->weight[p] * s[hc->x[p] * dx + hc->y[p] * dy];
+	return t;
+}
+
+static inline
+sval cell_value(const feature_cell *fc, const sval *sat,
+                const unsigned int *point, const sval *weight,
+                unsigned int num_points)
+{
+	const sval *s;
+	unsigned int j;
+	sval t;
+
+	s = &sat[fc->offset];
+	switch (fc->idx) {
+	case 0: return haar_value(s, fc->dx, fc->dy, &haar_table[0]);
+	case 1: return haar_value(s, fc->dx, fc->dy, &haar_table[1]);
+	case 2: return haar_value(s, fc->dx, fc->dy, &haar_table[2]);
+	case 3: return haar_value(s, fc->dx, fc->dy, &haar_table[3]);
+	case 4: return haar_value(s, fc->dx, fc->dy, &haar_table[4]);
+	case 5: return haar_value(s, fc->dx, fc->dy, &haar_table[5]);
+	case 6: return haar_value(s, fc->dx, fc->dy, &haar_table[6]);
+	case 7: return haar_value(s, fc->dx, fc->dy, &haar_table[7]);
+	}
+
+	t = 0;
+	for (j = 0; j < num_points; j++)
+		t += weight[j] * sat[point[j]];
+	return t;
+}
+
+static inline
+sval classifier_value(const compiled_cascade *cc, const sval *sat,
+                      unsigned int i)
+{
+	unsigned int first;
+
+	first = cc->first_point[i];
+	return cell_value(&cc->cell[i], sat, &cc->point[first],
+	                  &cc->weight[first], cc->first_point[i + 1] - first);
+}
+
+/*
+ * A parallel that falls below a rejection threshold stops summing but
+ * keeps its partial sum, capped below zero, so that it can still win a
+ * later stage; only a single parallel rejects the whole window.
+ */
+static inline
+double reject_score(const compiled_cascade *cc, double val)
+{
+	if (cc->num_parallels == 1) return -HUGE_VAL;
+	return MIN(val, -DBL_MIN);
+}
+
+static inline
+int reject_fixed(const compiled_cascade *cc, int val)
+{
+	if (cc->num_parallels == 1) return INT_MIN;
+	return MIN(val, -1);
+}
+
+static
+double evaluate_group(const compiled_cascade *cc, const sval *sat,
+                      double factor, unsigned int g, double val)
+{
+	unsigned int i, last;
+	sval t;
+
+	last = cc->first_classifier[g + 1];
+	for (i = cc->first_classifier[g]; i < last; i++) {
+		t = classifier_value(cc, sat, i);
+		if (((double) t) >= factor * cc->thresh[i])
+			val += cc->coef[i];
+		if (val < cc->reject[i])
+			return reject_score(cc, val);
+	}
+	return val;
+}
+
+static inline
+int fixed_point(const compiled_cascade *cc)
+{
+	return cc->fixed && cc->thresh_shift >= 0 && cc->coef_shift >= 0;
+}
+
+static inline
+int fixed_factor(double factor)
+{
+	factor = factor * (1 << FIXED_FACTOR_BITS) + 0.5;
+	factor = MAX(0, MIN(FIXED_MAX_FACTOR, factor));
+	return (int) factor;
+}
+
+static inline
+int fixed_score(const compiled_cascade *cc, double score)
+{
+	if (score == -HUGE_VAL) return INT_MIN;
+	return (int) (score * cc->coef_scale);
+}
+
+static inline
+double score_fixed(const compiled_cascade *cc, int val)
+{
+	if (val == INT_MIN) return -HUGE_VAL;
+	return ((double) val) * cc->coef_unit;
+}
+
+/*
+ * Since the feature value is an integer, it passes the threshold
+ * exactly when it is above floor((factor * thresh - 1) / 2^shift).
+ */
+static
+int evaluate_group_fixed(const compiled_cascade *cc, const sval *sat,
+                         int factor, unsigned int g, int val)
+{
+	unsigned int i, last;
+	sval t;
+
+	if (val == INT_MIN) return val;
+	val += cc->fixed_intercept[g];
+
+	last = cc->first_classifier[g + 1];
+	for (i = cc->first_classifier[g]; i < last; i++) {
+		t = classifier_value(cc, sat, i);
+		if (t > ((factor * cc->fixed_thresh[i] - 1) >> cc->thresh_shift))
+			val += cc->fixed_coef[i];
+		if (val < cc->fixed_reject[i])
+			return reject_fixed(cc, val);
+	}
+	return val;
+}
+
+/* The stage a window is rejected at (num_stages if it passes) is
+ * stored in depth, unless it is NULL */
+static
+double evaluate_stages_fixed(const compiled_cascade *cc, const sval *sat,
+                             double factor, int multi_exit,
+                             unsigned int stage, double *score,
+                             unsigned int *sel, unsigned int *depth)
+{
+	unsigned int k, g, best;
+	int f, val;
+
+	f = fixed_factor(factor);
+	if (cc->num_parallels == 1) {
+		val = fixed_score(cc, score[0]);
+		for (g = stage; g < cc->num_groups; g++) {
+			if (!multi_exit)
+				val = 0;
+
+			val = evaluate_group_fixed(cc, sat, f, g, val);
+			if (val < 0) {
+				if (depth) *depth = g;
+				return score_fixed(cc, val);
+			}
+		}
+		if (depth) *depth = cc->num_groups;
+		score[0] = score_fixed(cc, val);
+		return score[0];
+	}
+
+	g = stage * cc->num_parallels;
+	for (; stage < cc->num_stages; stage++) {
+		best = 0;
+		for (k = 0; k < cc->num_parallels; k++, g++) {
+			val = multi_exit ? fixed_score(cc, score[k]) : 0;
+			val = evaluate_group_fixed(cc, sat, f, g, val);
+			score[k] = score_fixed(cc, val);
+			if (score[k] > score[best])
+				best = k;
+		}
+		*sel = best;
+		if (score[best] < 0)
+			break;
+	}
+	if (depth) *depth = stage;
+	return score[*sel];
+}
+
+static
+double evaluate_stages(const compiled_cascade *cc, const sval *sat,
+                       double factor, int multi_exit, unsigned int stage,
+                       double *score, unsigned int *sel, unsigned int *depth)
+{
+	unsigned int k, g, best;
+	double val;
+
+	if (fixed_point(cc)) {
+		return evaluate_stages_fixed(cc, sat, factor, multi_exit,
+		                             stage, score, sel, depth);
+	}
+
+	if (cc->num_parallels == 1) {
+		val = score[0];
+		for (g = stage; g < cc->num_groups; g++) {
+			if (multi_exit)
+				val += cc->intercept[g];
+			else
+				val = cc->intercept[g];
+
+			val = evaluate_group(cc, sat, factor, g, val);
+			if (val < 0) {
+				if (depth) *depth = g;
+				return val;
+			}
+		}
+		if (depth) *depth = cc->num_groups;
+		score[0] = val;
+		return val;
+	}
+
+	g = stage * cc->num_parallels;
+	for (; stage < cc->num_stages; stage++) {
+		best = 0;
+		for (k = 0; k < cc->num_parallels; k++, g++) {
+			if (multi_exit)
+				score[k] += cc->intercept[g];
+			else
+				score[k] = cc->intercept[g];
+
+			score[k] = evaluate_group(cc, sat, factor, g, score[k]);
+			if (score[k] > score[best])
+				best = k;
+		}
+		*sel = best;
+		if (score[best] < 0)
+			break;
+	}
+	if (depth) *depth = stage;
+	return score[*sel];
+}
+
+#if defined(__AVX512F__) && !defined(SVAL_DOUBLE)
+static inline
+__m512i load_lanes(const sval *s, unsigned int step, __m512i idx)
+{
+	if (step == 1)
+		return _mm512_loadu_si512((const void *) s);
+	return _mm512_i32gather_epi32(idx, (const void *) s, 4);
+}
+
+static inline
+__m512i accumulate_rect(__m512i acc, __m512i r, sval w)
+{
+	if (w == 1) return _mm512_add_epi32(acc, r);
+	if (w == -1) return _mm512_sub_epi32(acc, r);
+	if (w == 2) return _mm512_add_epi32(acc, _mm512_add_epi32(r, r));
+	if (w == -2) return _mm512_sub_epi32(acc, _mm512_add_epi32(r, r));
+	return _mm512_add_epi32(acc, _mm512_mullo_epi32(r,
+	                        _mm512_set1_epi32(w)));
+}
+#elif defined(__AVX2__) && !defined(SVAL_DOUBLE)
+static inline
+__m256i load_lanes(const sval *s, unsigned int step, __m256i idx)
+{
+	if (step == 1)
+		return _mm256_loadu_si256((const __m256i *) s);
+	return _mm256_i32gather_epi32(s, idx, 4);
+}
+
+static inline
+__m256i accumulate_rect(__m256i acc, __m256i r, sval w)
+{
+	if (w == 1) return _mm256_add_epi32(acc, r);
+	if (w == -1) return _mm256_sub_epi32(acc, r);
+	if (w == 2) return _mm256_add_epi32(acc, _mm256_add_epi32(r, r));
+	if (w == -2) return _mm256_sub_epi32(acc, _mm256_add_epi32(r, r));
+	return _mm256_add_epi32(acc, _mm256_mullo_epi32(r,
+	                        _mm256_set1_epi32(w)));
+}
+#elif defined(__SSE4_1__) && !defined(SVAL_DOUBLE)
+static inline
+__m128i load_lanes(const sval *s)
+{
+	return _mm_loadu_si128((const __m128i *) s);
+}
+
+static inline
+__m128i accumulate_rect(__m128i acc, __m128i r, sval w)
+{
+	if (w == 1) return _mm_add_epi32(acc, r);
+	if (w == -1) return _mm_sub_epi32(acc, r);
+	if (w == 2) return _mm_add_epi32(acc, _mm_add_epi32(r, r));
+	if (w == -2) return _mm_sub_epi32(acc, _mm_add_epi32(r, r));
+	return _mm_add_epi32(acc, _mm_mullo_epi32(r, _mm_set1_epi32(w)));
+}
+#endif
+
+#if defined(__AVX512F__) && !defined(SVAL_DOUBLE)
+static inline
+void haar_lanes(const sval *s, unsigned int step, unsigned int dx,
+                unsigned int dy, const haar_cells *hc, sval *t)
+{
+	__m512i acc, idx;
+	unsigned int p;
+
+	acc = _mm512_setzero_si512();
+	idx = _mm512_mullo_epi32(_mm512_set1_epi32((int) step),
+	                         _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+	                                          7, 6, 5, 4, 3, 2, 1, 0));
+	for (p = 0; p < hc->num_points; p++) {
+		acc = accumulate_rect(acc, load_lanes(&s[hc->x[p] * dx
+		                                         + hc->y[p] * dy],
+		                                      step, idx),
+		                      hc->weight[p]);
+	}
+	_mm512_storeu_si512((void *) t, acc);
+}
+#elif defined(__AVX2__) && !defined(SVAL_DOUBLE)
+static inline
+void haar_lanes(const sval *s, unsigned int step, unsigned int dx,
+                unsigned int dy, const haar_cells *hc, sval *t)
+{
+	__m256i acc[2], idx;
+	unsigned int j, p;
+
+	acc[0] = _mm256_setzero_si256();
+	acc[1] = _mm256_setzero_si256();
+	idx = _mm256_mullo_epi32(_mm256_set1_epi32((int) step),
+	                         _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+	for (p = 0; p < hc->num_points; p++) {
+		for (j = 0; j < 2; j++) {
+			acc[j] = accumulate_rect(acc[j],
+			             load_lanes(&s[8 * j * step + hc->x[p] * dx
+			                           + hc->y[p] * dy], step, idx),
+			             hc->weight[p]);
+		}
+	}
+	_mm256_storeu_si256((__m256i *) t, acc[0]);
+	_mm256_storeu_si256((__m256i *) &t[8], acc[1]);
+}
+#elif defined(__SSE4_1__) && !defined(SVAL_DOUBLE)
+static inline
+void haar_lanes(const sval *s, unsigned int step, unsigned int dx,
+                unsigned int dy, const haar_cells *hc, sval *t)
+{
+	__m128i acc[COMPILED_LANES / 4];
+	unsigned int j, p;
+
+	(void) step;
+	for (j = 0; j < COMPILED_LANES / 4; j++)
+		acc[j] = _mm_setzero_si128();
+
+	for (p = 0; p < hc->num_points; p++) {
+		for (j = 0; j < COMPILED_LANES / 4; j++) {
+			acc[j] = accumulate_rect(acc[j],
+			             load_lanes(&s[4 * j + hc->x[p] * dx
+			                           + hc->y[p] * dy]),
+			             hc->weight[p]);
+		}
+	}
+
+	for (j = 0; j < COMPILED_LANES / 4; j++)
+		_mm_storeu_si128((__m128i *) &t[4 * j], acc[j]);
+}
+#endif
+
+#if (defined(__AVX2__) || defined(__SSE4_1__)) && !defined(SVAL_DOUBLE)
+static
+int cell_lanes(const feature_cell *fc, const sval *sat, unsigned int step,
+               sval *t)
+{
+	const sval *s;
+
+	s = &sat[fc->offset];
+	switch (fc->idx) {
+	case 0: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[0], t); break;
+	case 1: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[1], t); break;
+	case 2: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[2], t); break;
+	case 3: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[3], t); break;
+	case 4: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[4], t); break;
+	case 5: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[5], t); break;
+	case 6: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[6], t); break;
+	case 7: haar_lanes(s, step, fc->dx, fc->dy, &haar_table[7], t); break;
+	default: return FALSE;
+	}
+	return TRUE;
+}
+#endif
+
+/*
+ * The points of each rectangle come in groups of four, with weights
+ * (w, w, -w, -w), so the vector kernels add up the corners first and
+ * multiply once per rectangle.
+ */
+static
+void evaluate_lanes_feature(const sval *sat, unsigned int step,
+                            unsigned int num_lanes, const feature_cell *fc,
+                            const unsigned int *point, const sval *weight,
+                            unsigned int num_points, sval *t)
+{
+	unsigned int j;
+
+#if defined(__AVX512F__) && !defined(SVAL_DOUBLE)
+	if (num_lanes == COMPILED_LANES) {
+		__m512i acc, idx, r;
+		unsigned int p;
+
+		if (cell_lanes(fc, sat, step, t))
+			return;
+
+		acc = _mm512_setzero_si512();
+		idx = _mm512_mullo_epi32(_mm512_set1_epi32((int) step),
+		                         _mm512_set_epi32(15, 14, 13, 12,
+		                                          11, 10, 9, 8,
+		                                          7, 6, 5, 4,
+		                                          3, 2, 1, 0));
+		for (p = 0; p < num_points; p += 4) {
+			r = load_lanes(&sat[point[p]], step, idx);
+			r = _mm512_add_epi32(r, load_lanes(&sat[point[p + 1]],
+			                                   step, idx));
+			r = _mm512_sub_epi32(r, load_lanes(&sat[point[p + 2]],
+			                                   step, idx));
+			r = _mm512_sub_epi32(r, load_lanes(&sat[point[p + 3]],
+			                                   step, idx));
+			acc = accumulate_rect(acc, r, weight[p]);
+		}
+		_mm512_storeu_si512((void *) t, acc);
+		return;
+	}
+#elif defined(__AVX2__) && !defined(SVAL_DOUBLE)
+	if (num_lanes == COMPILED_LANES) {
+		__m256i acc[2], idx, r;
+		unsigned int off, p;
+		const sval *s;
+
+		if (cell_lanes(fc, sat, step, t))
+			return;
+
+		acc[0] = _mm256_setzero_si256();
+		acc[1] = _mm256_setzero_si256();
+		idx = _mm256_mullo_epi32(_mm256_set1_epi32((int) step),
+		                         _mm256_set_epi32(7, 6, 5, 4,
+		                                          3, 2, 1, 0));
+		for (p = 0; p < num_points; p += 4) {
+			for (j = 0; j < 2; j++) {
+				off = 8 * j * step;
+				s = &sat[off];
+				r = load_lanes(&s[point[p]], step, idx);
+				r = _mm256_add_epi32(r,
+				        load_lanes(&s[point[p + 1]], step, idx));
+				r = _mm256_sub_epi32(r,
+				        load_lanes(&s[point[p + 2]], step, idx));
+				r = _mm256_sub_epi32(r,
+				        load_lanes(&s[point[p + 3]], step, idx));
+				acc[j] = accumulate_rect(acc[j], r, weight[p]);
+			}
+		}
+		_mm256_storeu_si256((__m256i *) t, acc[0]);
+		_mm256_storeu_si256((__m256i *) &t[8], acc[1]);
+		return;
+	}
+#elif defined(__SSE4_1__) && !defined(SVAL_DOUBLE)
+	if (num_lanes == COMPILED_LANES && step == 1) {
+		__m128i acc[COMPILED_LANES / 4], r;
+		unsigned int p;
+		const sval *s;
+
+		if (cell_lanes(fc, sat, step, t))
+			return;
+
+		for (j = 0; j < COMPILED_LANES / 4; j++)
+			acc[j] = _mm_setzero_si128();
+
+		for (p = 0; p < num_points; p += 4) {
+			for (j = 0; j < COMPILED_LANES / 4; j++) {
+				s = &sat[4 * j];
+				r = load_lanes(&s[point[p]]);
+				r = _mm_add_epi32(r, load_lanes(&s[point[p + 1]]));
+				r = _mm_sub_epi32(r, load_lanes(&s[point[p + 2]]));
+				r = _mm_sub_epi32(r, load_lanes(&s[point[p + 3]]));
+				acc[j] = accumulate_rect(acc[j], r, weight[p]);
+			}
+		}
+
+		for (j = 0; j < COMPILED_LANES / 4; j++)
+			_mm_storeu_si128((__m128i *) &t[4 * j], acc[j]);
+		return;
+	}
+#endif
+
+	for (j = 0; j < num_lanes; j++)
+		t[j] = cell_value(fc, &sat[j * step], point, weight,
+		                  num_points);
+}
+
+/*
+ * Applies one classifier to the fixed-point sums of all lanes and
+ * returns the lanes that are not below its rejection threshold; lanes
+ * already rejected hold INT_MIN and take no further votes, and the sum
+ * a lane had when it was rejected is kept in part.
+ */
+#if defined(__AVX512F__) && !defined(SVAL_DOUBLE)
+static inline
+unsigned int fixed_lanes(const sval *t, const int *factor, int thresh,
+                         int shift, int coef, int reject, int *acc,
+                         int *part)
+{
+	__m512i a, r, dead;
+	__mmask16 live, pass, rej;
+
+	a = _mm512_loadu_si512((const void *) acc);
+	r = _mm512_mullo_epi32(_mm512_loadu_si512((const void *) factor),
+	                       _mm512_set1_epi32(thresh));
+	r = _mm512_sra_epi32(_mm512_sub_epi32(r, _mm512_set1_epi32(1)),
+	                     _mm_cvtsi32_si128(shift));
+	dead = _mm512_set1_epi32(INT_MIN);
+	live = _mm512_cmpneq_epi32_mask(a, dead);
+	pass = _mm512_cmpgt_epi32_mask(_mm512_loadu_si512((const void *) t),
+	                               r) & live;
+	a = _mm512_mask_add_epi32(a, pass, a, _mm512_set1_epi32(coef));
+	rej = _mm512_cmpgt_epi32_mask(_mm512_set1_epi32(reject), a) & live;
+	_mm512_mask_storeu_epi32((void *) part, rej, a);
+	a = _mm512_mask_mov_epi32(a, rej, dead);
+	_mm512_storeu_si512((void *) acc, a);
+	return (unsigned int) (live & ~rej) & 0xFFFF;
+}
+#elif defined(__AVX2__) && !defined(SVAL_DOUBLE)
+static inline
+unsigned int fixed_lanes(const sval *t, const int *factor, int thresh,
+                         int shift, int coef, int reject, int *acc,
+                         int *part)
+{
+	__m256i a, r, pass, rej, gone, dead;
+	unsigned int j, out;
+
+	dead = _mm256_set1_epi32(INT_MIN);
+	out = 0;
+	for (j = 0; j < COMPILED_LANES; j += 8) {
+		a = _mm256_loadu_si256((const __m256i *) &acc[j]);
+		gone = _mm256_cmpeq_epi32(a, dead);
+		r = _mm256_mullo_epi32(
+		        _mm256_loadu_si256((const __m256i *) &factor[j]),
+		        _mm256_set1_epi32(thresh));
+		r = _mm256_sra_epi32(_mm256_sub_epi32(r, _mm256_set1_epi32(1)),
+		                     _mm_cvtsi32_si128(shift));
+		pass = _mm256_cmpgt_epi32(
+		           _mm256_loadu_si256((const __m256i *) &t[j]), r);
+		pass = _mm256_andnot_si256(gone, pass);
+		a = _mm256_add_epi32(a, _mm256_and_si256(pass,
+		                        _mm256_set1_epi32(coef)));
+		rej = _mm256_andnot_si256(gone, _mm256_cmpgt_epi32(
+		          _mm256_set1_epi32(reject), a));
+		_mm256_storeu_si256((__m256i *) &part[j], _mm256_blendv_epi8(
+		    _mm256_loadu_si256((const __m256i *) &part[j]), a, rej));
+		a = _mm256_blendv_epi8(a, dead, rej);
+		_mm256_storeu_si256((__m256i *) &acc[j], a);
+		out |= (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(
+		            _mm256_or_si256(gone, rej))) << j;
+	}
+	return ~out & 0xFFFF;
+}
+#elif defined(__SSE4_1__) && !defined(SVAL_DOUBLE)
+static inline
+unsigned int fixed_lanes(const sval *t, const int *factor, int thresh,
+                         int shift, int coef, int reject, int *acc,
+                         int *part)
+{
+	__m128i a, r, pass, rej, gone, dead;
+	unsigned int j, out;
+
+	dead = _mm_set1_epi32(INT_MIN);
+	out = 0;
+	for (j = 0; j < COMPILED_LANES; j += 4) {
+		a = _mm_loadu_si128((const __m128i *) &acc[j]);
+		gone = _mm_cmpeq_epi32(a, dead);
+		r = _mm_mullo_epi32(_mm_loadu_si128((const __m128i *) &factor[j]),
+		                    _mm_set1_epi32(thresh));
+		r = _mm_sra_epi32(_mm_sub_epi32(r, _mm_set1_epi32(1)),
+		                  _mm_cvtsi32_si128(shift));
+		pass = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *) &t[j]),
+		                       r);
+		pass = _mm_andnot_si128(gone, pass);
+		a = _mm_add_epi32(a, _mm_and_si128(pass, _mm_set1_epi32(coef)));
+		rej = _mm_andnot_si128(gone, _mm_cmpgt_epi32(
+		          _mm_set1_epi32(reject), a));
+		_mm_storeu_si128((__m128i *) &part[j], _mm_blendv_epi8(
+		    _mm_loadu_si128((const __m128i *) &part[j]), a, rej));
+		a = _mm_blendv_epi8(a, dead, rej);
+		_mm_storeu_si128((__m128i *) &acc[j], a);
+		out |= (unsigned int) _mm_movemask_ps(_mm_castsi128_ps(
+		            _mm_or_si128(gone, rej))) << j;
+	}
+	return ~out & 0xFFFF;
+}
+#endif
+
+static
+unsigned int fixed_lanes_scalar(const sval *t, const int *factor,
+                                unsigned int num_lanes, int thresh, int shift,
+                                int coef, int reject, int *acc, int *part)
+{
+	unsigned int j, live;
+
+	live = 0;
+	for (j = 0; j < num_lanes; j++) {
+		if (acc[j] == INT_MIN) continue;
+
+		if (t[j] > ((factor[j] * thresh - 1) >> shift))
+			acc[j] += coef;
+		if (acc[j] < reject) {
+			part[j] = acc[j];
+			acc[j] = INT_MIN;
+		} else {
+			live |= 1u << j;
+		}
+	}
+	return live;
+}
+
+static
+unsigned int evaluate_lanes_fixed(const compiled_cascade *cc, const sval *sat,
+                                  unsigned int step, unsigned int num_lanes,
+                                  unsigned int mask, const double *factor,
+                                  int multi_exit, double *val, double *score,
+                                  unsigned int *sel)
+{
+	sval t[COMPILED_LANES];
+	int acc[COMPILED_LANES], part[COMPILED_LANES], f[COMPILED_LANES];
+	unsigned int i, j, k, g, np, stage, best;
+	unsigned int count, last, first_point, live;
+	double *sc;
+
+	np = cc->num_parallels;
+	for (j = 0; j < num_lanes; j++) {
+		for (k = 0; k < np; k++)
+			score[j * np + k] = 0;
+		val[j] = 0;
+		sel[j] = 0;
+		f[j] = fixed_factor(factor[j]);
+	}
+
+	g = 0;
+	for (stage = 0; stage < cc->num_stages && mask; stage++) {
+		count = 0;
+		for (j = 0; j < num_lanes; j++) {
+			if (mask & (1u << j)) count++;
+		}
+
+		if (count <= SCALAR_LANES) {
+			for (j = 0; j < num_lanes; j++) {
+				if (!(mask & (1u << j))) continue;
+				val[j] = evaluate_stages_fixed(cc, &sat[j * step],
+				                   factor[j], multi_exit, stage,
+				                   &score[j * np], &sel[j],
+				                   NULL);
+				if (val[j] < 0)
+					mask &= ~(1u << j);
+			}
+			return mask;
+		}
+
+		for (k = 0; k < np; k++, g++) {
+			for (j = 0; j < num_lanes; j++) {
+				acc[j] = 0;
+				if (multi_exit)
+					acc[j] = fixed_score(cc, score[j * np + k]);
+				if (acc[j] != INT_MIN)
+					acc[j] += cc->fixed_intercept[g];
+			}
+
+			last = cc->first_classifier[g + 1];
+			for (i = cc->first_classifier[g]; i < last; i++) {
+				first_point = cc->first_point[i];
+				evaluate_lanes_feature(sat, step, num_lanes,
+				                  &cc->cell[i],
+				                  &cc->point[first_point],
+				                  &cc->weight[first_point],
+				                  cc->first_point[i + 1] - first_point,
+				                  t);
+
+#if (defined(__AVX2__) || defined(__SSE4_1__)) && !defined(SVAL_DOUBLE)
+				if (num_lanes == COMPILED_LANES) {
+					live = fixed_lanes(t, f,
+					           cc->fixed_thresh[i],
+					           cc->thresh_shift,
+					           cc->fixed_coef[i],
+					           cc->fixed_reject[i], acc, part);
+				} else
+#endif
+				live = fixed_lanes_scalar(t, f, num_lanes,
+				           cc->fixed_thresh[i], cc->thresh_shift,
+				           cc->fixed_coef[i], cc->fixed_reject[i],
+				           acc, part);
+				if (!(live & mask)) break;
+			}
+
+			for (j = 0; j < num_lanes; j++) {
+				if (acc[j] == INT_MIN && np > 1)
+					acc[j] = reject_fixed(cc, part[j]);
+				score[j * np + k] = score_fixed(cc, acc[j]);
+			}
+		}
+
+		for (j = 0; j < num_lanes; j++) {
+			if (!(mask & (1u << j))) continue;
+
+			sc = &score[j * np];
+			best = 0;
+			for (k = 1; k < np; k++) {
+				if (sc[k] > sc[best])
+					best = k;
+			}
+			sel[j] = best;
+			val[j] = sc[best];
+			if (val[j] < 0)
+				mask &= ~(1u << j);
+		}
+	}
+	return mask;
+}
+
+static
+unsigned int evaluate_lanes(const compiled_cascade *cc, const sval *sat,
+                            unsigned int step, unsigned int num_lanes,
+                            unsigned int mask, const double *factor,
+                            int multi_exit, double *val, double *score,
+                            unsigned int *sel)
+{
+	sval t[COMPILED_LANES];
+	double acc[COMPILED_LANES];
+	unsigned int i, j, k, g, np, stage, best;
+	unsigned int count, last, first_point, live, dead;
+	double thresh, coef, reject, *sc;
+
+	if (fixed_point(cc)) {
+		return evaluate_lanes_fixed(cc, sat, step, num_lanes, mask,
+		                            factor, multi_exit, val, score, sel);
+	}
+
+	np = cc->num_parallels;
+	for (j = 0; j < num_lanes; j++) {
+		for (k = 0; k < np; k++)
+			score[j * np + k] = 0;
+		val[j] = 0;
+		sel[j] = 0;
+	}
+
+	g = 0;
+	for (stage = 0; stage < cc->num_stages && mask; stage++) {
+		count = 0;
+		for (j = 0; j < num_lanes; j++) {
+			if (mask & (1u << j)) count++;
+		}
+
+		if (count <= SCALAR_LANES) {
+			for (j = 0; j < num_lanes; j++) {
+				if (!(mask & (1u << j))) continue;
+				val[j] = evaluate_stages(cc, &sat[j * step],
+				                         factor[j], multi_exit,
+				                         stage, &score[j * np],
+				                         &sel[j], NULL);
+				if (val[j] < 0)
+					mask &= ~(1u << j);
+			}
+			return mask;
+		}
+
+		for (k = 0; k < np; k++, g++) {
+			for (j = 0; j < num_lanes; j++) {
+				if (multi_exit)
+					acc[j] = score[j * np + k];
+				else
+					acc[j] = 0;
+				acc[j] += cc->intercept[g];
+			}
+
+			dead = 0;
+			last = cc->first_classifier[g + 1];
+			for (i = cc->first_classifier[g]; i < last; i++) {
+				first_point = cc->first_point[i];
+				evaluate_lanes_feature(sat, step, num_lanes,
+				                  &cc->cell[i],
+				                  &cc->point[first_point],
+				                  &cc->weight[first_point],
+				                  cc->first_point[i + 1] - first_point,
+				                  t);
+
+				thresh = cc->thresh[i];
+				coef = cc->coef[i];
+				reject = cc->reject[i];
+				live = 0;
+				for (j = 0; j < num_lanes; j++) {
+					if (dead & (1u << j)) continue;
+
+					if (((double) t[j]) >= factor[j] * thresh)
+						acc[j] += coef;
+					if (acc[j] < reject) {
+						acc[j] = reject_score(cc, acc[j]);
+						dead |= 1u << j;
+					} else {
+						live |= 1u << j;
+					}
+				}
+				if (!(live & mask)) break;
+			}
+
+			for (j = 0; j < num_lanes; j++)
+				score[j * np + k] = acc[j];
+		}
+
+		for (j = 0; j < num_lanes; j++) {
+			if (!(mask & (1u << j))) continue;
+
+			sc = &score[j * np];
+			best = 0;
+			for (k = 1; k < np; k++) {
+				if (sc[k] > sc[best])
+					best = k;
+			}
+			sel[j] = best;
+			val[j] = sc[best];
+			if (val[j] < 0)
+				mask &= ~(1u << j);
+		}
+	}
+	return mask;
+}
+
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE)
+/* Same rounding as fixed_factor(), eight windows at a time */
+static inline
+__m256i fixed_factors(const double *factor)
+{
+	__m256d f, one, half, top;
+	__m128i r[2];
+	unsigned int j;
+
+	one = _mm256_set1_pd(1 << FIXED_FACTOR_BITS);
+	half = _mm256_set1_pd(0.5);
+	top = _mm256_set1_pd(FIXED_MAX_FACTOR);
+	for (j = 0; j < 2; j++) {
+		f = _mm256_mul_pd(_mm256_loadu_pd(&factor[4 * j]), one);
+		f = _mm256_min_pd(top, _mm256_add_pd(f, half));
+		f = _mm256_max_pd(_mm256_setzero_pd(), f);
+		r[j] = _mm256_cvttpd_epi32(f);
+	}
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(r[0]), r[1], 1);
+}
+#endif
+
+static
+void evaluate_batch_feature(const compiled_cascade *cc, const sval *sat,
+                            unsigned int i, unsigned int count,
+                            const unsigned int *offset, const double *factor,
+                            double *score, unsigned int np)
+{
+	unsigned int w, first, last;
+	const unsigned int *point;
+	const sval *weight;
+	const feature_cell *fc;
+	double thresh, coef;
+	int fixed, fixed_thresh, pass;
+	sval t;
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE)
+	unsigned int cell_point[MAX_HAAR_POINTS];
+	unsigned int j, num_points;
+	const unsigned int *pt;
+	const sval *wt;
+#endif
+
+	point = cc->point;
+	weight = cc->weight;
+	first = cc->first_point[i];
+	last = cc->first_point[i + 1];
+	thresh = cc->thresh[i];
+	coef = cc->coef[i];
+	fc = &cc->cell[i];
+
+	/* Fixed-point sums are exact in double, so they are kept there */
+	fixed = fixed_point(cc);
+	fixed_thresh = 0;
+	if (fixed) {
+		fixed_thresh = cc->fixed_thresh[i];
+		coef = score_fixed(cc, cc->fixed_coef[i]);
+	}
+
+	w = 0;
+#if defined(__AVX2__) && !defined(SVAL_DOUBLE)
+	/* Known Haar types gather their merged corners only */
+	if (fc->idx >= 0 && count >= 8) {
+		const haar_cells *hc;
+
+		hc = &haar_table[fc->idx];
+		for (j = 0; j < hc->num_points; j++) {
+			cell_point[j] = fc->offset + hc->x[j] * fc->dx
+			                + hc->y[j] * fc->dy;
+		}
+		pt = cell_point;
+		wt = hc->weight;
+		num_points = hc->num_points;
+	} else {
+		pt = &point[first];
+		wt = &weight[first];
+		num_points = last - first;
+	}
+
+#if defined(__AVX512F__)
+	for (; w + 16 <= count; w += 16) {
+		__m512i off, acc, x;
+		unsigned int mask, b;
+
+		off = _mm512_loadu_si512((const void *) &offset[w]);
+		acc = _mm512_setzero_si512();
+		for (j = 0; j < num_points; j++) {
+			x = _mm512_i32gather_epi32(off, &sat[pt[j]], 4);
+			acc = _mm512_add_epi32(acc, _mm512_mullo_epi32(x,
+			                       _mm512_set1_epi32(wt[j])));
+		}
+
+		if (fixed) {
+			x = _mm512_inserti64x4(_mm512_castsi256_si512(
+			        fixed_factors(&factor[w])),
+			        fixed_factors(&factor[w + 8]), 1);
+			x = _mm512_mullo_epi32(x,
+			        _mm512_set1_epi32(fixed_thresh));
+			x = _mm512_sra_epi32(_mm512_sub_epi32(x,
+			        _mm512_set1_epi32(1)),
+			        _mm_cvtsi32_si128(cc->thresh_shift));
+			mask = _mm512_cmpgt_epi32_mask(acc, x);
+		} else {
+			mask = _mm512_cmp_pd_mask(_mm512_cvtepi32_pd(
+			          _mm512_castsi512_si256(acc)),
+			          _mm512_mul_pd(_mm512_loadu_pd(&factor[w]),
+			                        _mm512_set1_pd(thresh)),
+			          _CMP_GE_OQ);
+			mask |= (unsigned int) _mm512_cmp_pd_mask(
+			          _mm512_cvtepi32_pd(
+			              _mm512_extracti64x4_epi64(acc, 1)),
+			          _mm512_mul_pd(_mm512_loadu_pd(&factor[w + 8]),
+			                        _mm512_set1_pd(thresh)),
+			          _CMP_GE_OQ) << 8;
+		}
+		for (b = 0; mask; b++, mask >>= 1) {
+			if (mask & 1)
+				score[(w + b) * np] += coef;
+		}
+	}
+#endif
+
+	for (; w + 8 <= count; w += 8) {
+		__m256i off, acc, x;
+		__m256d lo, hi;
+		unsigned int mask, b;
+
+		off = _mm256_loadu_si256((const __m256i *) &offset[w]);
+		acc = _mm256_setzero_si256();
+		for (j = 0; j < num_points; j++) {
+			x = _mm256_i32gather_epi32(&sat[pt[j]], off, 4);
+			acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(x,
+			                       _mm256_set1_epi32(wt[j])));
+		}
+
+		if (fixed) {
+			x = _mm256_mullo_epi32(fixed_factors(&factor[w]),
+			        _mm256_set1_epi32(fixed_thresh));
+			x = _mm256_sra_epi32(_mm256_sub_epi32(x,
+			        _mm256_set1_epi32(1)),
+			        _mm_cvtsi32_si128(cc->thresh_shift));
+			mask = (unsigned int) _mm256_movemask_ps(
+			          _mm256_castsi256_ps(_mm256_cmpgt_epi32(acc, x)));
+		} else {
+			lo = _mm256_mul_pd(_mm256_loadu_pd(&factor[w]),
+			                   _mm256_set1_pd(thresh));
+			hi = _mm256_mul_pd(_mm256_loadu_pd(&factor[w + 4]),
+			                   _mm256_set1_pd(thresh));
+			mask = (unsigned int) _mm256_movemask_pd(_mm256_cmp_pd(
+			          _mm256_cvtepi32_pd(_mm256_castsi256_si128(acc)),
+			          lo, _CMP_GE_OQ));
+			mask |= (unsigned int) _mm256_movemask_pd(_mm256_cmp_pd(
+			          _mm256_cvtepi32_pd(
+			              _mm256_extracti128_si256(acc, 1)),
+			          hi, _CMP_GE_OQ)) << 4;
+		}
+		for (b = 0; mask; b++, mask >>= 1) {
+			if (mask & 1)
+				score[(w + b) * np] += coef;
+		}
+	}
+#endif
+
+	for (; w < count; w++) {
+		t = cell_value(fc, &sat[offset[w]], &point[first], &weight[first],
+		               last - first);
+		if (fixed) {
+			pass = t > ((fixed_factor(factor[w]) * fixed_thresh - 1)
+			            >> cc->thresh_shift);
+		} else {
+			pass = ((double) t) >= factor[w] * thresh;
+		}
+		if (pass)
+			score[w * np] += coef;
+	}
+}
+
+static
+int group_rejects(const compiled_cascade *cc, unsigned int g)
+{
+	unsigned int i;
+
+	for (i = cc->first_classifier[g]; i < cc->first_classifier[g + 1];
+	     i++) {
+		if (cc->reject[i] > -HUGE_VAL)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Evaluates one stage of the cascade over a batch of windows, one
+ * classifier at a time, and compacts the windows that pass it to the
+ * front of the arrays.  With a single parallel, windows that fall below
+ * a rejection threshold are dropped as soon as that happens; with more,
+ * groups that have rejection thresholds go window by window, since a
+ * rejected parallel has to stop summing.
+ */
+static
+unsigned int evaluate_batch(const compiled_cascade *cc, const sval *sat,
+                            int multi_exit, unsigned int stage,
+                            unsigned int count, unsigned int *offset,
+                            double *factor, unsigned int *index,
+                            double *score, unsigned int *sel)
+{
+	unsigned int i, k, w, g, np, num, best, last;
+	double intercept, reject, *sc;
+	int fixed;
+
+	fixed = fixed_point(cc);
+	np = cc->num_parallels;
+	g = stage * np;
+	for (k = 0; k < np; k++, g++) {
+		if (np > 1 && group_rejects(cc, g)) {
+			for (w = 0; w < count; w++) {
+				sc = &score[w * np + k];
+				if (!multi_exit)
+					*sc = 0;
+				if (fixed) {
+					*sc = score_fixed(cc, evaluate_group_fixed(cc,
+					          &sat[offset[w]],
+					          fixed_factor(factor[w]), g,
+					          fixed_score(cc, *sc)));
+				} else {
+					*sc = evaluate_group(cc, &sat[offset[w]],
+					          factor[w], g,
+					          *sc + cc->intercept[g]);
+				}
+			}
+			continue;
+		}
+
+		intercept = cc->intercept[g];
+		if (fixed)
+			intercept = score_fixed(cc, cc->fixed_intercept[g]);
+
+		for (w = 0; w < count; w++) {
+			if (multi_exit)
+				score[w * np + k] += intercept;
+			else
+				score[w * np + k] = intercept;
+		}
+
+		last = cc->first_classifier[g + 1];
+		for (i = cc->first_classifier[g]; i < last; i++) {
+			evaluate_batch_feature(cc, sat, i, count, offset,
+			                       factor, &score[k], np);
+
+			reject = cc->reject[i];
+			if (fixed)
+				reject = score_fixed(cc, cc->fixed_reject[i]);
+			if (reject == -HUGE_VAL) continue;
+
+			num = 0;
+			for (w = 0; w < count; w++) {
+				if (score[w] < reject) continue;
+
+				offset[num] = offset[w];
+				factor[num] = factor[w];
+				index[num] = index[w];
+				score[num++] = score[w];
+			}
+			count = num;
+		}
+	}
+
+	num = 0;
+	for (w = 0; w < count; w++) {
+		sc = &score[w * np];
+		best = 0;
+		for (k = 1; k < np; k++) {
+			if (sc[k] > sc[best])
+				best = k;
+		}
+		if (sc[best] < 0) continue;
+
+		if (num != w) {
+			offset[num] = offset[w];
+			factor[num] = factor[w];
+			index[num] = index[w];
+			memmove(&score[num * np], sc, np * sizeof(double));
+		}
+		sel[num++] = best;
+	}
+	return num;
+}
+
+static
+void evaluate_samples(sval *const *sat, unsigned int n,
+                      const feature_index_opt *fo, double *vals)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		vals[i] = (double) cell_value(&fo->cell, sat[i], fo->point,
+		                              fo->weight, fo->num_opt_points);
+	}
+}
+
+static
+void make_buckets(boosting *bs, const double *feat_vals)
+{
+	unsigned int i, j;
+	double bkt_range;
+
+	memset(bs->buckets, 0, (bs->num_buckets + 1) * sizeof(unsigned int));
+	bkt_range = bs->bkt_max - bs->bkt_min;
+	for (i = 0; i < bs->n; i++) {
+		double fval = feat_vals[i];
+
+		if (fval < bs->bkt_min) {
+			j = 0;
+		} else if (fval >= bs->bkt_max)  {
+			j = bs->num_buckets;
+		} else {
+			fval = (fval - bs->bkt_min) / bkt_range;
+			j = (unsigned int) (fval * bs->num_buckets);
+		}
+
+		bs->next[i] = bs->buckets[j];
+		bs->buckets[j] = i + 1;
+	}
+}
+
+static
+void train_aux(boosting *bs, unsigned int index, unsigned int k)
+{
+	unsigned int i, j;
+	double val, init_val, sum_pf, sum_pn, sum_nf, sum_nn;
+	double sum2_pf, sum2_pn, sum2_nf, sum2_nn;
+
+	sum_pn = 0;
+	sum_nn = 0;
+	sum_pf = bs->init_sum_p[k];
+	sum_nf = bs->init_sum_n[k];
+
+	init_val = bs->init_val - sum_pf - sum_nf;
+
+	for (i = 0; i < bs->num_buckets; i++) {
+		j = bs->buckets[i];
+		if (j == 0) continue;
+		do {
+			j--;
+			if (bs->y[j] > 0 && bs->sel_parallel[j] == k) {
+				sum_pf -= bs->weights[k][j];
+				sum_pn += bs->weights[k][j];
+			} else if (bs->y[j] < 0) {
+				sum_nf -= bs->weights[k][j];
+				sum_nn += bs->weights[k][j];
+			}
+			j = bs->next[j];
+		} while (j > 0);
+
+		sum2_pf = MAX(TAU, sum_pf);
+		sum2_nf = MAX(TAU, sum_nf);
+		sum2_pn = MAX(TAU, sum_pn);
+		sum2_nn = MAX(TAU, sum_nn);
+
+		val = init_val;
+		val += 2 * sqrt(sum2_pf * sum2_nf);
+		val += 2 * sqrt(sum2_pn * sum2_nn);
+		if (val < bs->best_val) {
+			bs->best_val = val;
+			bs->best_index = index;
+			bs->best_parallel = k;
+			bs->best_thresh_index = i;
+			bs->best_sum_pn = sum2_pn;
+			bs->best_sum_nn = sum2_nn;
+			bs->best_sum_pf = sum2_pf;
+			bs->best_sum_nf = sum2_nf;
+		}
+	}
+}
+
+const kernels KERNEL_NAME(kernels, KERNEL_SUFFIX) = {
+	KERNEL_XSTR(KERNEL_SUFFIX),
+	&integral,
+	&resize,
+	&resize_integral,
+	&stddev_row,
+	&evaluate_stages,
+	&evaluate_lanes,
+	&evaluate_batch,
+	&evaluate_samples,
+	&make_buckets,
+	&train_aux
+};
@@ -0,0 +1,74 @@
+
+#ifndef __KERNELS_H
+#define __KERNELS_H
+
+#include "compiled_cascade.h"
+#include "boosting.h"
+#include "features.h"
+#include "image.h"
+
+/* Data structures and types */
+typedef void (*integral_kernel)(const image *img, features *f,
+                                unsigned int first, unsigned int last);
+typedef void (*resize_kernel)(const image *img, image *t, unsigned int height,
+                              unsigned int top);
+typedef void (*resize_integral_kernel)(const image *img, features *f,
+                                       unsigned int height, unsigned int top);
+typedef unsigned int (*stddev_row_kernel)(const features *f, const window *w,
+                                          unsigned int step,
+                                          unsigned int count,
+                                          double min_stddev,
+                                          unsigned int *left,
+                                          double *factor);
+typedef double (*evaluate_kernel)(const compiled_cascade *cc, const sval *sat,
+                                  double factor, int multi_exit,
+                                  unsigned int stage, double *score,
+                                  unsigned int *sel, unsigned int *depth);
+typedef unsigned int (*evaluate_lanes_kernel)(const compiled_cascade *cc,
+                                              const sval *sat,
+                                              unsigned int step,
+                                              unsigned int num_lanes,
+                                              unsigned int mask,
+                                              const double *factor,
+                                              int multi_exit, double *val,
+                                              double *score,
+                                              unsigned int *sel);
+typedef unsigned int (*evaluate_batch_kernel)(const compiled_cascade *cc,
+                                              const sval *sat,
+                                              int multi_exit,
+                                              unsigned int stage,
+                                              unsigned int count,
+                                              unsigned int *offset,
+                                              double *factor,
+                                              unsigned int *index,
+                                              double *score,
+                                              unsigned int *sel);
+typedef void (*evaluate_samples_kernel)(sval *const *sat, unsigned int n,
+                                        const feature_index_opt *fo,
+                                        double *vals);
+typedef void (*make_buckets_kernel)(boosting *bs, const double *feat_vals);
+typedef void (*train_aux_kernel)(boosting *bs, unsigned int index,
+                                 unsigned int k);
+
+typedef
+struct kernels_st {
+	const char *name;
+	integral_kernel integral;
+	resize_kernel resize;
+	resize_integral_kernel resize_integral;
+	stddev_row_kernel stddev_row;
+	evaluate_kernel evaluate;
+	evaluate_lanes_kernel evaluate_lanes;
+	evaluate_batch_kernel evaluate_batch;
+	evaluate_samples_kernel evaluate_samples;
+	make_buckets_kernel make_buckets;
+	train_aux_kernel train_aux;
+} kernels;
+
+/* Variables */
+extern const kernels kernels_scalar;
+extern const kernels kernels_sse42;
+extern const kernels kernels_avx2;
+extern const kernels kernels_avx512;
+
+#endif /* __KERNELS_H */
@@ -2,15 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "trainer.h"
 #include "detector.h"
 #include "cascade.h"
+#include "codegen.h"
 #include "samples.h"
 #include "features.h"
 #include "image.h"
 #include "window.h"
 #include "random.h"
+#include "thread_pool.h"
+#include "stopwatch.h"
+#include "cpu.h"
 #include "utils.h"
 
 #define ARG_FLAG_REQ       1
@@ -21,7 +26,8 @@
 #define ARG_FLAG_DEF      32
 
 enum argument_type {
-	ARG_CMD, ARG_FILE, ARG_DIR, ARG_DBL, ARG_INT, ARG_UINT, ARG_BOOL
+	ARG_CMD, ARG_FILE, ARG_DIR, ARG_DBL, ARG_INT, ARG_UINT, ARG_BOOL,
+	ARG_STR
 };
 
 union argument_value {
@@ -44,6 +50,8 @@ struct argument_definition {
 
 static
 struct argument_definition arguments[] = {
+	{ "--cpu", ARG_STR, 0, NULL,
+	  "Instruction set (scalar, sse42, avx2, avx512 or auto)" },
 	{ "--help", ARG_BOOL, 0, NULL,
 	  "Print this help" },
 	{ "train", ARG_CMD, ARG_FLAG_NEEDFILE, NULL,
@@ -153,6 +161,45 @@ struct argument_definition arguments[] = {
 	  "Minimum detection window height" },
 	{ "--max_height", ARG_UINT, ARG_FLAG_REQ, "0",
 	  "Maximum detection window height" },
+	{ "--min_neighbors", ARG_UINT, ARG_FLAG_REQ, "0",
+	  "Group similar windows and keep groups with more of them" },
+	{ "--group_eps", ARG_DBL, ARG_FLAG_REQ | ARG_FLAG_PROB, "0.2",
+	  "How far apart the edges of grouped windows may be, "
+	  "relative to their size" },
+	{ "--simd", ARG_BOOL, 0, NULL,
+	  "Evaluate several adjacent windows at once" },
+	{ "--tiled", ARG_BOOL, 0, NULL,
+	  "Scan the windows in tiles whose rows stay in the cache" },
+	{ "--scale_features", ARG_BOOL, 0, NULL,
+	  "Scale the features instead of the image" },
+	{ "--breadth_first", ARG_BOOL, 0, NULL,
+	  "Evaluate each stage over all windows before the next one" },
+	{ "--fixed_point", ARG_BOOL, 0, NULL,
+	  "Compare features and sum the stages in integer arithmetic" },
+	{ "--generated", ARG_BOOL, 0, NULL,
+	  "Use the evaluator compiled into the program for the cascade" },
+	{ "--adaptive", ARG_BOOL, 0, NULL,
+	  "Skip past hopeless windows and search around promising ones" },
+	{ "--dense_depth", ARG_UINT, ARG_FLAG_REQ, "2",
+	  "Stages a window must pass to search around it at step 1" },
+	{ "--skip_margin", ARG_DBL, ARG_FLAG_REQ, "0",
+	  "How far below zero a first stage score must be to skip ahead" },
+	{ "--skip_windows", ARG_UINT, ARG_FLAG_REQ, "1",
+	  "How many windows to skip after a hopeless one" },
+	{ "--coarse_to_fine", ARG_BOOL, 0, NULL,
+	  "Scan at the step first and at step 1 only around what passed" },
+	{ "--coarse_stages", ARG_UINT, ARG_FLAG_REQ, "0",
+	  "Stages evaluated in the coarse scan, 0 for all of them" },
+	{ "--stream", ARG_BOOL, 0, NULL,
+	  "Scan each level in strips to bound the memory used" },
+	{ "--strip_height", ARG_UINT, ARG_FLAG_REQ, "0",
+	  "Height of the strips, 0 for four windows" },
+	{ "--pyramid", ARG_BOOL, 0, NULL,
+	  "Resize each level from the nearest halved octave of the image" },
+	{ "--pyramid_arena", ARG_BOOL, 0, NULL,
+	  "Resize all the levels up front into one buffer, implies --pyramid" },
+	{ "--num_threads", ARG_UINT, ARG_FLAG_REQ, "1",
+	  "Number of threads used to scan the image" },
 	{ "--output", ARG_FILE, ARG_FLAG_REQ, NULL,
 	  "Name of the output image file" },
 	{ "--help", ARG_BOOL, 0, NULL,
@@ -184,12 +231,80 @@ struct argument_definition arguments[] = {
 	  "Minimum detection window height" },
 	{ "--max_height", ARG_UINT, ARG_FLAG_REQ, "0",
 	  "Maximum detection window height" },
+	{ "--min_neighbors", ARG_UINT, ARG_FLAG_REQ, "0",
+	  "Group similar windows and keep groups with more of them" },
+	{ "--group_eps", ARG_DBL, ARG_FLAG_REQ | ARG_FLAG_PROB, "0.2",
+	  "How far apart the edges of grouped windows may be, "
+	  "relative to their size" },
+	{ "--simd", ARG_BOOL, 0, NULL,
+	  "Evaluate several adjacent windows at once" },
+	{ "--tiled", ARG_BOOL, 0, NULL,
+	  "Scan the windows in tiles whose rows stay in the cache" },
+	{ "--scale_features", ARG_BOOL, 0, NULL,
+	  "Scale the features instead of the image" },
+	{ "--breadth_first", ARG_BOOL, 0, NULL,
+	  "Evaluate each stage over all windows before the next one" },
+	{ "--fixed_point", ARG_BOOL, 0, NULL,
+	  "Compare features and sum the stages in integer arithmetic" },
+	{ "--generated", ARG_BOOL, 0, NULL,
+	  "Use the evaluator compiled into the program for the cascade" },
+	{ "--adaptive", ARG_BOOL, 0, NULL,
+	  "Skip past hopeless windows and search around promising ones" },
+	{ "--dense_depth", ARG_UINT, ARG_FLAG_REQ, "2",
+	  "Stages a window must pass to search around it at step 1" },
+	{ "--skip_margin", ARG_DBL, ARG_FLAG_REQ, "0",
+	  "How far below zero a first stage score must be to skip ahead" },
+	{ "--skip_windows", ARG_UINT, ARG_FLAG_REQ, "1",
+	  "How many windows to skip after a hopeless one" },
+	{ "--coarse_to_fine", ARG_BOOL, 0, NULL,
+	  "Scan at the step first and at step 1 only around what passed" },
+	{ "--coarse_stages", ARG_UINT, ARG_FLAG_REQ, "0",
+	  "Stages evaluated in the coarse scan, 0 for all of them" },
+	{ "--stream", ARG_BOOL, 0, NULL,
+	  "Scan each level in strips to bound the memory used" },
+	{ "--strip_height", ARG_UINT, ARG_FLAG_REQ, "0",
+	  "Height of the strips, 0 for four windows" },
+	{ "--pyramid", ARG_BOOL, 0, NULL,
+	  "Resize each level from the nearest halved octave of the image" },
+	{ "--pyramid_arena", ARG_BOOL, 0, NULL,
+	  "Resize all the levels up front into one buffer, implies --pyramid" },
 	{ "--num_cascades", ARG_UINT, ARG_FLAG_REQ, "1",
 	  "Number of cascades used to evaluate" },
 	{ "--num_threads", ARG_UINT, ARG_FLAG_REQ, "1",
 	  "Number of threads used to evaluate" },
 	{ "--help", ARG_BOOL, 0, NULL,
 	  "Print this help" },
+	{ "compile", ARG_CMD, ARG_FLAG_NEEDFILE, NULL,
+	  "Write a cascade file as C source", "file" },
+	{ "--output", ARG_FILE, ARG_FLAG_REQ, NULL,
+	  "Name of the output C file" },
+	{ "--name", ARG_STR, ARG_FLAG_REQ, "cascade",
+	  "Name of the compiled cascade" },
+	{ "--help", ARG_BOOL, 0, NULL,
+	  "Print this help" },
+	{ "convert", ARG_CMD, ARG_FLAG_NEEDFILE, NULL,
+	  "Convert a cascade file between the text and binary formats",
+	  "file" },
+	{ "--output", ARG_FILE, ARG_FLAG_REQ, NULL,
+	  "Name of the output cascade file" },
+	{ "--binary", ARG_BOOL, 0, NULL,
+	  "Write the memory-mappable binary format instead of text" },
+	{ "--help", ARG_BOOL, 0, NULL,
+	  "Print this help" },
+	{ "benchmark", ARG_CMD, 0, NULL,
+	  "Time the suppression of synthetic detections", "" },
+	{ "--num_objects", ARG_UINT, ARG_FLAG_REQ, "10000",
+	  "Number of candidate windows" },
+	{ "--cluster_size", ARG_UINT, ARG_FLAG_REQ | ARG_FLAG_POS, "20",
+	  "Number of candidates around each synthetic object" },
+	{ "--match_thresh", ARG_DBL, ARG_FLAG_REQ | ARG_FLAG_PROB, "0.75",
+	  "Minimum match threshold" },
+	{ "--overlap_thresh", ARG_DBL, ARG_FLAG_REQ | ARG_FLAG_PROB, "0.33",
+	  "Minimum overlap threshold" },
+	{ "--seed", ARG_UINT, ARG_FLAG_REQ, "1",
+	  "Seed of the random candidates" },
+	{ "--help", ARG_BOOL, 0, NULL,
+	  "Print this help" },
 };
 #define ARGUMENTS_SIZE \
   (sizeof(arguments) / sizeof(struct argument_definition))
@@ -214,6 +329,9 @@ const char *get_specifier(enum argument_type arg_type)
 	case ARG_INT:
 		specifier = "<int>";
 		break;
+	case ARG_STR:
+		specifier = "<str>";
+		break;
 	default:
 		specifier = "";
 		break;
@@ -228,6 +346,7 @@ int parse_argument(enum argument_type arg_type, const char *str,
 	switch (arg_type) {
 	case ARG_FILE:
 	case ARG_DIR:
+	case ARG_STR:
 		val->str_val = (char *) str;
 		break;
 	case ARG_UINT:
@@ -535,15 +654,18 @@ error_resize:
 static
 int detect_objects(unsigned int cmd)
 {
-	unsigned int i, step;
+	unsigned int i, step, mode, num_threads, dense_depth;
 	const char *img_filename, *cascade_filename, *output_filename;
-	double scale, min_stddev, match_thresh, overlap_thresh;
+	double scale, min_stddev, match_thresh, overlap_thresh, skip_margin;
 	unsigned int min_width, min_height, max_width, max_height;
+	unsigned int min_neighbors;
 	union argument_value val;
 	int multi_exit;
+	thread_pool tp;
 	cascade c;
 	image img;
 
+	thread_pool_reset(&tp);
 	if (!get_argument(cmd, NULL, &val))
 		return FALSE;
 	img_filename = val.str_val;
@@ -568,6 +690,10 @@ int detect_objects(unsigned int cmd)
 		return FALSE;
 	max_height = val.uint_val;
 
+	if (!get_argument(cmd, "--num_threads", &val))
+		return FALSE;
+	num_threads = val.uint_val;
+
 	image_init(&img);
 	if (!cascade_load(&c, cascade_filename, TRUE))
 		goto error_detect;
@@ -609,6 +735,64 @@ int detect_objects(unsigned int cmd)
 	cascade_set_scan(&c, min_width, min_height,
 	                 max_width, max_height);
 
+	if (!get_argument(cmd, "--min_neighbors", &val))
+		goto error_detect;
+	min_neighbors = val.uint_val;
+
+	if (!get_argument(cmd, "--group_eps", &val))
+		goto error_detect;
+	cascade_set_grouping(&c, min_neighbors, val.dbl_val);
+
+	if (!get_argument(cmd, "--dense_depth", &val))
+		goto error_detect;
+	dense_depth = val.uint_val;
+
+	if (!get_argument(cmd, "--skip_margin", &val))
+		goto error_detect;
+	skip_margin = val.dbl_val;
+
+	if (!get_argument(cmd, "--skip_windows", &val))
+		goto error_detect;
+	cascade_set_adaptive(&c, dense_depth, skip_margin, val.uint_val);
+
+	if (!get_argument(cmd, "--coarse_stages", &val))
+		goto error_detect;
+	cascade_set_coarse(&c, val.uint_val);
+
+	if (!get_argument(cmd, "--strip_height", &val))
+		goto error_detect;
+	cascade_set_strip(&c, val.uint_val);
+	cascade_set_pyramid(&c, get_argument(cmd, "--pyramid_arena", &val));
+
+	mode = cascade_get_mode(&c);
+	if (get_argument(cmd, "--simd", &val))
+		mode |= CASCADE_MODE_SIMD;
+	if (get_argument(cmd, "--tiled", &val))
+		mode |= CASCADE_MODE_TILED;
+	if (get_argument(cmd, "--scale_features", &val))
+		mode |= CASCADE_MODE_SCALE;
+	if (get_argument(cmd, "--breadth_first", &val))
+		mode |= CASCADE_MODE_BREADTH;
+	if (get_argument(cmd, "--fixed_point", &val))
+		mode |= CASCADE_MODE_FIXED;
+	if (get_argument(cmd, "--generated", &val))
+		mode |= CASCADE_MODE_GENERATED;
+	if (get_argument(cmd, "--adaptive", &val))
+		mode |= CASCADE_MODE_ADAPTIVE;
+	if (get_argument(cmd, "--coarse_to_fine", &val))
+		mode |= CASCADE_MODE_COARSE;
+	if (get_argument(cmd, "--stream", &val))
+		mode |= CASCADE_MODE_STREAM;
+	if (get_argument(cmd, "--pyramid", &val))
+		mode |= CASCADE_MODE_PYRAMID;
+	cascade_set_mode(&c, mode);
+
+	if (num_threads > 1) {
+		if (!thread_pool_init(&tp, num_threads))
+			goto error_detect;
+		cascade_set_thread_pool(&c, &tp);
+	}
+
 	cascade_set_image(&c, &img);
 
 	if (!cascade_detect(&c, TRUE))
@@ -628,11 +812,13 @@ int detect_objects(unsigned int cmd)
 	if (!image_write(&img, output_filename))
 		goto error_detect;
 
+	thread_pool_cleanup(&tp);
 	cascade_cleanup(&c);
 	image_cleanup(&img);
 	return TRUE;
 
 error_detect:
+	thread_pool_cleanup(&tp);
 	cascade_cleanup(&c);
 	image_cleanup(&img);
 	return FALSE;
@@ -641,11 +827,12 @@ error_detect:
 static
 int evaluate_cascade(unsigned int cmd)
 {
-	unsigned int step, num_cascades, num_threads;
+	unsigned int step, mode, num_cascades, num_threads, dense_depth;
 	const char *cascade_filename, *test_filename;
 	const char *testing_directory;
-	double scale, min_stddev, match_thresh, overlap_thresh;
+	double scale, min_stddev, match_thresh, overlap_thresh, skip_margin;
 	unsigned int min_width, min_height, max_width, max_height;
+	unsigned int min_neighbors;
 	union argument_value val;
 	int multi_exit;
 	detector dt;
@@ -727,6 +914,59 @@ int evaluate_cascade(unsigned int cmd)
 	detector_set_scan(&dt, min_width, min_height,
 	                  max_width, max_height);
 
+	if (!get_argument(cmd, "--min_neighbors", &val))
+		goto error_evaluate;
+	min_neighbors = val.uint_val;
+
+	if (!get_argument(cmd, "--group_eps", &val))
+		goto error_evaluate;
+	detector_set_grouping(&dt, min_neighbors, val.dbl_val);
+
+	if (!get_argument(cmd, "--dense_depth", &val))
+		goto error_evaluate;
+	dense_depth = val.uint_val;
+
+	if (!get_argument(cmd, "--skip_margin", &val))
+		goto error_evaluate;
+	skip_margin = val.dbl_val;
+
+	if (!get_argument(cmd, "--skip_windows", &val))
+		goto error_evaluate;
+	detector_set_adaptive(&dt, dense_depth, skip_margin, val.uint_val);
+
+	if (!get_argument(cmd, "--coarse_stages", &val))
+		goto error_evaluate;
+	detector_set_coarse(&dt, val.uint_val);
+
+	if (!get_argument(cmd, "--strip_height", &val))
+		goto error_evaluate;
+	detector_set_strip(&dt, val.uint_val);
+	detector_set_pyramid(&dt,
+	                     get_argument(cmd, "--pyramid_arena", &val));
+
+	mode = detector_get_mode(&dt);
+	if (get_argument(cmd, "--simd", &val))
+		mode |= CASCADE_MODE_SIMD;
+	if (get_argument(cmd, "--tiled", &val))
+		mode |= CASCADE_MODE_TILED;
+	if (get_argument(cmd, "--scale_features", &val))
+		mode |= CASCADE_MODE_SCALE;
+	if (get_argument(cmd, "--breadth_first", &val))
+		mode |= CASCADE_MODE_BREADTH;
+	if (get_argument(cmd, "--fixed_point", &val))
+		mode |= CASCADE_MODE_FIXED;
+	if (get_argument(cmd, "--generated", &val))
+		mode |= CASCADE_MODE_GENERATED;
+	if (get_argument(cmd, "--adaptive", &val))
+		mode |= CASCADE_MODE_ADAPTIVE;
+	if (get_argument(cmd, "--coarse_to_fine", &val))
+		mode |= CASCADE_MODE_COARSE;
+	if (get_argument(cmd, "--stream", &val))
+		mode |= CASCADE_MODE_STREAM;
+	if (get_argument(cmd, "--pyramid", &val))
+		mode |= CASCADE_MODE_PYRAMID;
+	detector_set_mode(&dt, mode);
+
 	if (!samples_read(&smp, test_filename))
 		goto error_evaluate;
 
@@ -743,6 +983,210 @@ error_evaluate:
 	return FALSE;
 }
 
+static
+int compile_cascade(unsigned int cmd)
+{
+	const char *cascade_filename, *output_filename, *name;
+	union argument_value val;
+	cascade c;
+
+	if (!get_argument(cmd, NULL, &val))
+		return FALSE;
+	cascade_filename = val.str_val;
+
+	if (!get_argument(cmd, "--output", &val))
+		return FALSE;
+	output_filename = val.str_val;
+
+	if (!get_argument(cmd, "--name", &val))
+		return FALSE;
+	name = val.str_val;
+
+	if (!cascade_load(&c, cascade_filename, TRUE))
+		goto error_compile;
+
+	if (!cascade_compile(&c))
+		goto error_compile;
+
+	if (!codegen_save(&c.cc, output_filename, name, cascade_filename))
+		goto error_compile;
+
+	cascade_cleanup(&c);
+	return TRUE;
+
+error_compile:
+	cascade_cleanup(&c);
+	return FALSE;
+}
+
+static
+int convert_cascade(unsigned int cmd)
+{
+	const char *cascade_filename, *output_filename;
+	union argument_value val;
+	int binary;
+	cascade c;
+
+	if (!get_argument(cmd, NULL, &val))
+		return FALSE;
+	cascade_filename = val.str_val;
+
+	if (!get_argument(cmd, "--output", &val))
+		return FALSE;
+	output_filename = val.str_val;
+
+	binary = get_argument(cmd, "--binary", &val);
+
+	if (!cascade_load(&c, cascade_filename, TRUE))
+		goto error_convert;
+
+	if (binary) {
+		if (!cascade_save_binary(&c, output_filename))
+			goto error_convert;
+	} else {
+		if (!cascade_save(&c, output_filename))
+			goto error_convert;
+	}
+
+	cascade_cleanup(&c);
+	return TRUE;
+
+error_convert:
+	cascade_cleanup(&c);
+	return FALSE;
+}
+
+/* Adds clusters of jittered windows over a 4096x3072 frame, at sizes
+ * spanning 30 steps of 1.1 from 24 pixels */
+static
+int add_candidates(cascade *c, unsigned int num_objects,
+                   unsigned int cluster_size, unsigned int seed)
+{
+	unsigned int i;
+	double x, y, size, s, left, top;
+	window w;
+
+	init_genrand(seed);
+	x = y = size = 0;
+	for (i = 0; i < num_objects; i++) {
+		if (i % cluster_size == 0) {
+			size = 24 * pow(1.1, floor(30 * genrand_real2()));
+			x = genrand_real2() * (4096 - size);
+			y = genrand_real2() * (3072 - size);
+		}
+
+		s = size * (1 + 0.05 * genrand_gauss());
+		left = x + s * genrand_gauss() / 8;
+		top = y + s * genrand_gauss() / 8;
+		w.left = (unsigned int) MAX(0, left);
+		w.top = (unsigned int) MAX(0, top);
+		w.width = w.height = (unsigned int) s;
+		if (!cascade_add_object(c, &w, genrand_gauss()))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static
+int time_separate(unsigned int num_objects, unsigned int cluster_size,
+                  unsigned int seed, double match_thresh,
+                  double overlap_thresh, int reference, window *kept,
+                  unsigned int *num_kept, double *elapsed)
+{
+	unsigned int i;
+	double cpu_time;
+	stopwatch sw;
+	cascade c;
+
+	if (!cascade_init(&c, 24, 24, 1))
+		return FALSE;
+
+	cascade_set_params(&c, 1.1, 0, 1, match_thresh, overlap_thresh,
+	                   FALSE);
+	if (!add_candidates(&c, num_objects, cluster_size, seed)) {
+		cascade_cleanup(&c);
+		return FALSE;
+	}
+
+	stopwatch_start(&sw);
+	if (reference)
+		cascade_separate_reference(&c, 0);
+	else
+		cascade_separate(&c, 0);
+	stopwatch_stop(&sw, elapsed, &cpu_time);
+
+	*num_kept = c.num_detected_objects;
+	for (i = 0; i < c.num_detected_objects; i++)
+		kept[i] = c.detected_objects[i].w;
+
+	cascade_cleanup(&c);
+	return TRUE;
+}
+
+static
+int benchmark(unsigned int cmd)
+{
+	unsigned int num_objects, cluster_size, seed;
+	unsigned int num_greedy, num_grid;
+	double match_thresh, overlap_thresh;
+	double greedy_time, grid_time;
+	window *greedy, *grid;
+	union argument_value val;
+	int ret;
+
+	if (!get_argument(cmd, "--num_objects", &val))
+		return FALSE;
+	num_objects = val.uint_val;
+
+	if (!get_argument(cmd, "--cluster_size", &val))
+		return FALSE;
+	cluster_size = val.uint_val;
+
+	if (!get_argument(cmd, "--match_thresh", &val))
+		return FALSE;
+	match_thresh = val.dbl_val;
+
+	if (!get_argument(cmd, "--overlap_thresh", &val))
+		return FALSE;
+	overlap_thresh = val.dbl_val;
+
+	if (!get_argument(cmd, "--seed", &val))
+		return FALSE;
+	seed = val.uint_val;
+
+	greedy = (window *) xmalloc(2 * (num_objects + 1) * sizeof(window));
+	if (!greedy) return FALSE;
+	grid = &greedy[num_objects + 1];
+
+	ret = FALSE;
+	if (!time_separate(num_objects, cluster_size, seed, match_thresh,
+	                   overlap_thresh, TRUE, greedy, &num_greedy,
+	                   &greedy_time))
+		goto error_benchmark;
+
+	if (!time_separate(num_objects, cluster_size, seed, match_thresh,
+	                   overlap_thresh, FALSE, grid, &num_grid,
+	                   &grid_time))
+		goto error_benchmark;
+
+	printf("num_objects = %u, cluster_size = %u, "
+	       "match_thresh = %g, overlap_thresh = %g\n",
+	       num_objects, cluster_size, match_thresh, overlap_thresh);
+	printf("greedy: %u kept in %.3f s\n", num_greedy, greedy_time);
+	printf("grid: %u kept in %.3f s\n", num_grid, grid_time);
+
+	if (num_greedy != num_grid
+	    || memcmp(greedy, grid, num_grid * sizeof(window)) != 0) {
+		error("the grid keeps different windows");
+		goto error_benchmark;
+	}
+	ret = TRUE;
+
+error_benchmark:
+	free(greedy);
+	return ret;
+}
+
 static
 int train(unsigned int cmd)
 {
@@ -945,6 +1389,7 @@ int main(int argc, char **argv)
 {
 	unsigned int cmd;
 	const char *cmd_name;
+	union argument_value val;
 #ifdef CONSOLE_UNBUFFERED
 	setvbuf(stdout, 0, _IONBF, 0);
 	setvbuf(stderr, 0, _IONBF, 0);
@@ -957,6 +1402,11 @@ int main(int argc, char **argv)
 	if (cmd == 0)
 		return 0;
 
+	if (!get_argument(0, "--cpu", &val))
+		val.str_val = NULL;
+	if (!cpu_select(val.str_val))
+		return 1;
+
 	cmd_name = arguments[cmd - 1].arg_name;
 	if (strcmp("resize", cmd_name) == 0) {
 		if (!resize_image(cmd))
@@ -967,6 +1417,15 @@ int main(int argc, char **argv)
 	} else if (strcmp("evaluate", cmd_name) == 0) {
 		if (!evaluate_cascade(cmd))
 			return 1;
+	} else if (strcmp("compile", cmd_name) == 0) {
+		if (!compile_cascade(cmd))
+			return 1;
+	} else if (strcmp("convert", cmd_name) == 0) {
+		if (!convert_cascade(cmd))
+			return 1;
+	} else if (strcmp("benchmark", cmd_name) == 0) {
+		if (!benchmark(cmd))
+			return 1;
 	} else {
 		if (!train(cmd))
 			return 1;
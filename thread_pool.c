@@ -137,6 +137,17 @@ job_item *allocate_new_job(thread_pool *tp)
 }
 
 int thread_pool_enqueue(thread_pool *tp, job_cb cb, void *arg)
+{
+	return thread_pool_enqueue_count(tp, cb, arg, NULL);
+}
+
+/*
+ * A job with a count increments it and decrements it once done, instead
+ * of going to the done queue, so that it can be waited for with
+ * thread_pool_wait_count() while other jobs are in the pool.
+ */
+int thread_pool_enqueue_count(thread_pool *tp, job_cb cb, void *arg,
+                              unsigned int *count)
 {
 	job_item *job;
 
@@ -149,12 +160,16 @@ int thread_pool_enqueue(thread_pool *tp, job_cb cb, void *arg)
 
 	job->cb = cb;
 	job->arg = arg;
+	job->count = count;
 	job->next = NULL;
 
 	if (tp->last != NULL) tp->last->next = job;
 	if (tp->first == NULL) tp->first = job;
 	tp->last = job;
-	tp->num_remaining++;
+	if (count)
+		(*count)++;
+	else
+		tp->num_remaining++;
 	pthread_cond_signal(&tp->q_cnd);
 	pthread_mutex_unlock(&tp->q_mtx);
 
@@ -196,6 +211,15 @@ void thread_pool_wait(thread_pool *tp)
 	pthread_mutex_unlock(&tp->q_mtx);
 }
 
+void thread_pool_wait_count(thread_pool *tp, unsigned int *count)
+{
+	pthread_mutex_lock(&tp->q_mtx);
+	while (!tp->cancelled && *count > 0) {
+		pthread_cond_wait(&tp->q_cnd_master, &tp->q_mtx);
+	}
+	pthread_mutex_unlock(&tp->q_mtx);
+}
+
 int thread_pool_pending(thread_pool *tp, int remaining, int done)
 {
 	int ret;
@@ -245,12 +269,18 @@ void *worker_function(void *arg)
 		job->cb(job->arg);
 
 		pthread_mutex_lock(&tp->q_mtx);
-		tp->num_remaining--;
-		job->next = NULL;
-		if (tp->done_last) tp->done_last->next = job;
-		if (tp->done_first == NULL) tp->done_first = job;
-		tp->done_last = job;
-		tp->num_done++;
+		if (job->count) {
+			(*job->count)--;
+			job->next = tp->free;
+			tp->free = job;
+		} else {
+			tp->num_remaining--;
+			job->next = NULL;
+			if (tp->done_last) tp->done_last->next = job;
+			if (tp->done_first == NULL) tp->done_first = job;
+			tp->done_last = job;
+			tp->num_done++;
+		}
 		pthread_cond_broadcast(&tp->q_cnd_master);
 		pthread_mutex_unlock(&tp->q_mtx);
 	}
@@ -12,6 +12,7 @@ struct job_item_st {
 	struct job_item_st *next;
 	void *arg;
 	job_cb cb;
+	unsigned int *count;
 } job_item;
 
 typedef
@@ -32,8 +33,11 @@ void thread_pool_reset(thread_pool *tp);
 int thread_pool_init(thread_pool *tp, unsigned int num_threads);
 void thread_pool_cleanup(thread_pool *tp);
 int thread_pool_enqueue(thread_pool *tp, job_cb cb, void *arg);
+int thread_pool_enqueue_count(thread_pool *tp, job_cb cb, void *arg,
+                              unsigned int *count);
 void *thread_pool_dequeue(thread_pool *tp, int wait);
 void thread_pool_wait(thread_pool *tp);
+void thread_pool_wait_count(thread_pool *tp, unsigned int *count);
 int thread_pool_pending(thread_pool *tp, int remaining, int done);
 void thread_pool_flush_done(thread_pool *tp);
 
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <float.h>
 #include <math.h>
 #include <unistd.h>
 
@@ -20,6 +21,7 @@
 #include "utils.h"
 
 #define MAX_ITERATIONS       100
+#define REJECT_MARGIN        1e-4
 
 void trainer_reset(trainer_data *td)
 {
@@ -491,7 +493,7 @@ void trainer_job(void *arg)
 	boosting *bs;
 	feature_enumerator fe;
 	feature_index_opt fo;
-	unsigned int i, fstart, fend, id;
+	unsigned int fstart, fend, id;
 	double *feat_vals;
 
 	info = (trainer_job_info *) arg;
@@ -516,9 +518,7 @@ void trainer_job(void *arg)
 				continue;
 		}
 		features_optimize(&fe.fi, &fo, td->width + 1);
-		for (i = 0; i < td->n; i++) {
-			feat_vals[i] = features_evaluate_fast(td->sat[i], &fo);
-		}
+		features_evaluate_samples(td->sat, td->n, &fo, feat_vals);
 
 		boosting_train(&info->bs, info->feat_vals, fe.count + 1,
 		               info->parallel);
@@ -570,9 +570,7 @@ int train_classifier(trainer_data *td, cascade *c, cascade_stage *st,
 	fi = fe.fi;
 
 	features_optimize(&fe.fi, &fo, td->width + 1);
-	for (i = 0; i < td->n; i++) {
-		feat_vals[i] = features_evaluate_fast(td->sat[i], &fo);
-	}
+	features_evaluate_samples(td->sat, td->n, &fo, feat_vals);
 	boosting_compute_best(bs, feat_vals);
 	boosting_update(bs, feat_vals, bs->best_parallel, bs->best_coef,
 	                bs->best_intercept, bs->best_threshold);
@@ -603,7 +601,7 @@ int optimize_classifier(trainer_data *td, cascade_stage *st, classifier *cl,
 {
 	boosting *bs;
 	double *feat_vals;
-	unsigned int i, fp, fn;
+	unsigned int fp, fn;
 	feature_index_opt fo;
 	int changed;
 
@@ -611,9 +609,7 @@ int optimize_classifier(trainer_data *td, cascade_stage *st, classifier *cl,
 	feat_vals = td->tinfos[0].feat_vals;
 
 	features_optimize(&cl->fi, &fo, td->width + 1);
-	for (i = 0; i < td->n; i++) {
-		feat_vals[i] = features_evaluate_fast(td->sat[i], &fo);
-	}
+	features_evaluate_samples(td->sat, td->n, &fo, feat_vals);
 	td->best_val = bs->best_val;
 	changed = boosting_refine(bs, feat_vals, parallel, cl->coef,
 	                          cl->intercept, cl->thresh, &fp, &fn);
@@ -668,6 +664,79 @@ int optimize_stage(trainer_data *td, cascade *c, cascade_stage *st)
 	return TRUE;
 }
 
+static
+void stage_pass_values(trainer_data *td, const classifier *cl, double *part,
+                       double sign)
+{
+	feature_index_opt fo;
+	double *feat_vals;
+	unsigned int i;
+
+	feat_vals = td->tinfos[0].feat_vals;
+	features_optimize(&cl->fi, &fo, td->width + 1);
+	features_evaluate_samples(td->sat, td->n, &fo, feat_vals);
+	for (i = 0; i < td->n; i++) {
+		if (feat_vals[i] >= cl->thresh)
+			part[i] += sign * cl->coef;
+	}
+}
+
+static
+int calibrate_stage(trainer_data *td, cascade *c, cascade_stage *st)
+{
+	unsigned int i, k, count;
+	double *part, min_part;
+	classifier *cl;
+	boosting *bs;
+
+	bs = &td->tinfos[0].bs;
+	part = (double *) xmalloc(td->n * sizeof(double));
+	if (!part) return FALSE;
+
+	count = 0;
+	for (k = 0; k < c->num_parallels; k++) {
+		for (i = 0; i < td->n; i++)
+			part[i] = bs->vals[k][i];
+
+		for (cl = st->cl[k]; cl; cl = cl->next)
+			stage_pass_values(td, cl, part, -1);
+
+		for (cl = st->cl[k]; cl; cl = cl->next) {
+			stage_pass_values(td, cl, part, 1);
+
+			cl->reject = -HUGE_VAL;
+			if (!cl->next) continue;
+
+			min_part = HUGE_VAL;
+			for (i = 0; i < td->n; i++) {
+				if (td->y[i] > 0 && bs->vals[k][i] >= 0)
+					min_part = MIN(min_part, part[i]);
+			}
+			if (min_part == HUGE_VAL) continue;
+
+			cl->reject = min_part
+			             - REJECT_MARGIN * (1 + fabs(min_part));
+			count++;
+
+			/* Same as detection: a rejected parallel keeps its
+			 * partial sum, capped below zero, as its score */
+			for (i = 0; i < td->n; i++) {
+				if (part[i] == -HUGE_VAL || part[i] >= cl->reject)
+					continue;
+
+				bs->vals[k][i] = -HUGE_VAL;
+				if (c->num_parallels > 1)
+					bs->vals[k][i] = MIN(part[i], -DBL_MIN);
+				part[i] = -HUGE_VAL;
+			}
+		}
+	}
+
+	printf("Rejection thresholds set for %u classifiers\n", count);
+	free(part);
+	return TRUE;
+}
+
 static
 int train_stage(trainer_data *td, int *done)
 {
@@ -732,6 +801,9 @@ int train_stage(trainer_data *td, int *done)
 		}
 	}
 
+	if (!calibrate_stage(td, c, st))
+		return FALSE;
+
 	cascade_consolidate_stage(c, st);
 	if (i == td->max_classifiers)
 		*done = TRUE;
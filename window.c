@@ -1,4 +1,6 @@
 
+#include <math.h>
+
 #include "window.h"
 #include "utils.h"
 
@@ -88,3 +90,22 @@ double window_similarity(const window *w1, const window *w2)
 
 	return areaI / areaU;
 }
+
+/* Same test as OpenCV's grouping: every edge of one window lies within
+ * eps times the mean of the smaller width and height of the other's */
+int window_similar(const window *w1, const window *w2, double eps)
+{
+	double delta;
+
+	delta = 0.5 * eps * (MIN(w1->width, w2->width)
+	                     + MIN(w1->height, w2->height));
+	if (fabs((double) w1->left - (double) w2->left) > delta)
+		return FALSE;
+	if (fabs((double) w1->top - (double) w2->top) > delta)
+		return FALSE;
+	if (fabs((double) (w1->left + w1->width)
+	         - (double) (w2->left + w2->width)) > delta)
+		return FALSE;
+	return fabs((double) (w1->top + w1->height)
+	            - (double) (w2->top + w2->height)) <= delta;
+}
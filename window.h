@@ -18,5 +18,6 @@ int window_overlap(const window *w1, const window *w2,
 void window_compute_overlap(const window *w1, const window *w2,
                             double *match_thresh, double *overlap_thresh);
 double window_similarity(const window *w1, const window *w2);
+int window_similar(const window *w1, const window *w2, double eps);
 
 #endif /* __WINDOW_H */